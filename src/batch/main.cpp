@@ -0,0 +1,137 @@
+/*
+	Batch renderer: renders a scene description to a sequence of image files, without a window or OpenGL.
+
+		BatchRender scene.txt [-o pattern] [-n frames] [-s WIDTHxHEIGHT] [-j threads]
+
+	The frames are encoded by the TaskScheduler workers while the next ones are drawn.
+*/
+
+#include "scene.h"
+#include "framework/image_saver.h"
+#include "framework/task_scheduler.h"
+#include "framework/frame_arena.h"
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+
+#ifdef WIN32
+	#include <direct.h>
+	#define getcwd _getcwd
+#else
+	#include <unistd.h>
+#endif
+
+// The framework resolves relative names from the res folder, the command line ones are relative to the working directory
+static std::string absolutePath(const std::string& path)
+{
+	bool absolute = !path.empty() && (path[0] == '/' || path[0] == '\\' || (path.size() > 1 && path[1] == ':'));
+	char cwd[4096];
+	if (absolute || getcwd(cwd, sizeof(cwd)) == NULL)
+		return path;
+	return std::string(cwd) + "/" + path;
+}
+
+static void printUsage()
+{
+	std::cout << "Usage: BatchRender scene.txt [-o pattern] [-n frames] [-s WIDTHxHEIGHT] [-j threads]" << std::endl;
+	std::cout << "  -o  printf pattern of the frame files (.png or .tga), e.g. out/frame_%04d.png" << std::endl;
+	std::cout << "  -n  number of frames" << std::endl;
+	std::cout << "  -s  frame size" << std::endl;
+	std::cout << "  -j  worker threads (default: one per core besides the main thread)" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+	{
+		printUsage();
+		return 1;
+	}
+
+	const char* scene_file = NULL;
+	const char* output = NULL;
+	int frames = 0, width = 0, height = 0;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		bool has_value = i + 1 < argc;
+		if (arg == "-o" && has_value)
+			output = argv[++i];
+		else if (arg == "-n" && has_value)
+			frames = atoi(argv[++i]);
+		else if (arg == "-s" && has_value && sscanf(argv[i + 1], "%dx%d", &width, &height) == 2)
+			++i;
+		else if (arg == "-j" && has_value)
+			TaskScheduler::SetNumThreads((unsigned int)std::max(atoi(argv[++i]), 0));
+		else if (arg[0] != '-' && !scene_file)
+			scene_file = argv[i];
+		else
+		{
+			printUsage();
+			return 1;
+		}
+	}
+
+	BatchScene scene;
+	if (!scene_file || !scene.Load(absolutePath(scene_file).c_str()))
+		return 1;
+
+	if (output)
+		scene.output = output;
+	if (frames > 0)
+		scene.frames = frames;
+	if (width > 0 && height > 0)
+	{
+		scene.width = width;
+		scene.height = height;
+	}
+	scene.output = absolutePath(scene.output);
+	scene.Init();
+
+	Image framebuffer(scene.width, scene.height);
+
+	// Frames waiting to be written, each one keeps a copy of the framebuffer
+	const unsigned int max_pending = TaskScheduler::Get()->GetNumThreads() + 1;
+	int failed = 0;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	double render_time = 0.0;
+
+	for (int frame = 0; frame < scene.frames; ++frame)
+	{
+		std::chrono::steady_clock::time_point frame_start = std::chrono::steady_clock::now();
+		scene.RenderFrame(frame, framebuffer);
+		render_time += std::chrono::duration<double>(std::chrono::steady_clock::now() - frame_start).count();
+
+		while (ImageSaver::GetPendingSaves() >= max_pending)
+		{
+			if (TaskScheduler::Get()->PumpMainThread() == 0)
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+
+		ImageSaver::SaveAsync(framebuffer, scene.GetFrameFilename(frame).c_str(), [&failed](bool success) { if (!success) failed++; });
+		TaskScheduler::Get()->PumpMainThread();
+		FrameArena::Get()->Reset();
+	}
+
+	while (ImageSaver::GetPendingSaves() > 0)
+	{
+		if (TaskScheduler::Get()->PumpMainThread() == 0)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	double total_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "Rendered " << scene.frames << " frames of " << scene.width << "x" << scene.height << " in " << total_time << " s ("
+		<< render_time * 1000.0 / scene.frames << " ms drawing per frame)" << std::endl;
+
+	if (failed)
+	{
+		std::cerr << "--- " << failed << " frames could not be saved" << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,407 @@
+#include "scene.h"
+#include "framework/utils.h"
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+static Color parseColor(const std::string& text)
+{
+	Vector3 v = parseVector3(text.c_str(), ',');
+	Color c;
+	c.Set(v.x, v.y, v.z);
+	return c;
+}
+
+// Draw lists are drawn by tiles only with several cores, on one the tiles would run one after the other
+static bool drawTiled()
+{
+	static const bool tiled = std::thread::hardware_concurrency() > 1;
+	return tiled;
+}
+
+// Files of the scene are relative to its folder
+static std::string joinPath(const std::string& dir, const std::string& file)
+{
+	bool absolute = !file.empty() && (file[0] == '/' || file[0] == '\\' || (file.size() > 1 && file[1] == ':'));
+	return absolute || dir.empty() ? file : dir + "/" + file;
+}
+
+bool BatchScene::Load(const char* filename)
+{
+	std::ifstream file(filename);
+	if (!file.is_open())
+	{
+		std::cerr << "--- Failed to load scene: " << filename << std::endl;
+		return false;
+	}
+
+	std::string path = filename;
+	size_t slash = path.find_last_of("\\/");
+	std::string base_dir = slash == std::string::npos ? "" : path.substr(0, slash);
+
+	bool ok = true;
+	std::string line;
+	for (int number = 1; std::getline(file, line); ++number)
+	{
+		size_t comment = line.find('#');
+		if (comment != std::string::npos)
+			line.erase(comment);
+
+		std::vector<std::string> tokens = tokenize(line, " \t\r");
+		if (tokens.empty())
+			continue;
+
+		if (!ParseCommand(tokens, base_dir))
+		{
+			std::cerr << filename << ":" << number << ": invalid command: " << line << std::endl;
+			ok = false;
+		}
+	}
+
+	if (width <= 0 || height <= 0 || frames <= 0 || fps <= 0.0f)
+	{
+		std::cerr << filename << ": invalid size, frames or fps" << std::endl;
+		ok = false;
+	}
+
+	if (ok)
+		std::cout << "+++ Scene loaded: " << filename << std::endl;
+	return ok;
+}
+
+bool BatchScene::ParseCommand(const std::vector<std::string>& tokens, const std::string& base_dir)
+{
+	const std::string& name = tokens[0];
+	const size_t args = tokens.size() - 1;
+	Command command;
+
+	if (name == "size" && args == 2)
+	{
+		width = atoi(tokens[1].c_str());
+		height = atoi(tokens[2].c_str());
+	}
+	else if (name == "frames" && args == 1)
+		frames = atoi(tokens[1].c_str());
+	else if (name == "fps" && args == 1)
+		fps = (float)atof(tokens[1].c_str());
+	else if (name == "output" && args == 1)
+		output = tokens[1];
+	else if (name == "seed" && args == 1)
+		particles.SetSeed(strtoull(tokens[1].c_str(), NULL, 10));
+	else if (name == "background" && args == 1)
+		background = parseColor(tokens[1]);
+	else if (name == "line" && args == 3)
+	{
+		command.type = LINE;
+		command.p0 = parseVector2(tokens[1].c_str());
+		command.p1 = parseVector2(tokens[2].c_str());
+		command.color = parseColor(tokens[3]);
+		commands.push_back(command);
+	}
+	else if (name == "rect" && args >= 3 && args <= 5)
+	{
+		command.type = RECT;
+		command.p0 = parseVector2(tokens[1].c_str());
+		command.p1 = parseVector2(tokens[2].c_str());
+		command.color = parseColor(tokens[3]);
+		if (args >= 4)
+			command.border = atoi(tokens[4].c_str());
+		if (args >= 5)
+		{
+			command.filled = true;
+			command.fill = parseColor(tokens[5]);
+		}
+		commands.push_back(command);
+	}
+	else if (name == "triangle" && (args == 4 || args == 5))
+	{
+		command.type = TRIANGLE;
+		command.p0 = parseVector2(tokens[1].c_str());
+		command.p1 = parseVector2(tokens[2].c_str());
+		command.p2 = parseVector2(tokens[3].c_str());
+		command.color = parseColor(tokens[4]);
+		if (args == 5)
+		{
+			command.filled = true;
+			command.fill = parseColor(tokens[5]);
+		}
+		commands.push_back(command);
+	}
+	else if (name == "image" && args == 2)
+	{
+		std::unique_ptr<Image> image(new Image());
+		if (!image->Load(joinPath(base_dir, tokens[1]).c_str(), true))
+			return false;
+
+		command.type = IMAGE;
+		command.p0 = parseVector2(tokens[2].c_str());
+		command.resource = (int)images.size();
+		images.push_back(std::move(image));
+		commands.push_back(command);
+	}
+	else if (name == "particles" && args >= 1 && args <= 4)
+	{
+		particles.SetCapacity(atoi(tokens[1].c_str()));
+
+		ParticleSystem::BlendMode mode = ParticleSystem::PIXEL;
+		if (args >= 2)
+		{
+			if (tokens[2] == "additive") mode = ParticleSystem::ADDITIVE;
+			else if (tokens[2] == "alpha") mode = ParticleSystem::ALPHA;
+			else if (tokens[2] != "pixel") return false;
+		}
+		float radius = args >= 3 ? (float)atof(tokens[3].c_str()) : 1.0f;
+		float opacity = args >= 4 ? (float)atof(tokens[4].c_str()) : 1.0f;
+		particles.SetBlendMode(mode, radius, opacity);
+
+		// Only one particle system, drawn at the position of its first command
+		if (!hasParticles)
+		{
+			command.type = PARTICLES;
+			commands.push_back(command);
+			hasParticles = true;
+		}
+	}
+	else if (name == "emitter" && args >= 4 && args <= 10 && args != 5)
+	{
+		ParticleEmitter emitter;
+		const std::string& shape = tokens[1];
+		if (shape == "point") emitter.shape = ParticleEmitter::POINT;
+		else if (shape == "line") emitter.shape = ParticleEmitter::LINE;
+		else if (shape == "rect") emitter.shape = ParticleEmitter::RECT;
+		else if (shape == "circle") emitter.shape = ParticleEmitter::CIRCLE;
+		else return false;
+
+		emitter.position = parseVector2(tokens[2].c_str());
+		emitter.size = parseVector2(tokens[3].c_str());
+		emitter.rate = (float)atof(tokens[4].c_str());
+		if (args >= 6)
+		{
+			emitter.angle = (float)atof(tokens[5].c_str()) * DEG2RAD;
+			emitter.spread = (float)atof(tokens[6].c_str()) * DEG2RAD;
+		}
+		if (args >= 7)
+		{
+			Vector2 speed = parseVector2(tokens[7].c_str());
+			emitter.speedMin = speed.x;
+			emitter.speedMax = speed.y;
+		}
+		if (args >= 8)
+		{
+			Vector2 ttl = parseVector2(tokens[8].c_str());
+			emitter.ttlMin = ttl.x;
+			emitter.ttlMax = ttl.y;
+		}
+		if (args >= 9)
+			emitter.colorMin = emitter.colorMax = parseColor(tokens[9]);
+		if (args >= 10)
+			emitter.colorMax = parseColor(tokens[10]);
+		particles.AddEmitter(emitter);
+	}
+	else if (name == "gravity" && args == 1)
+	{
+		ParticleForce force;
+		force.type = ParticleForce::GRAVITY;
+		force.vector = parseVector2(tokens[1].c_str());
+		particles.AddForce(force);
+	}
+	else if (name == "wind" && args == 2)
+	{
+		ParticleForce force;
+		force.type = ParticleForce::WIND;
+		force.vector = parseVector2(tokens[1].c_str());
+		force.strength = (float)atof(tokens[2].c_str());
+		particles.AddForce(force);
+	}
+	else if (name == "attractor" && (args == 2 || args == 3))
+	{
+		ParticleForce force;
+		force.type = ParticleForce::ATTRACTOR;
+		force.position = parseVector2(tokens[1].c_str());
+		force.strength = (float)atof(tokens[2].c_str());
+		if (args == 3)
+			force.radius = (float)atof(tokens[3].c_str());
+		particles.AddForce(force);
+	}
+	else if (name == "interaction" && args == 2)
+		particles.SetInteraction((float)atof(tokens[1].c_str()), (float)atof(tokens[2].c_str()));
+	else if (name == "camera" && (args == 2 || args == 3))
+	{
+		eye = parseVector3(tokens[1].c_str(), ',');
+		center = parseVector3(tokens[2].c_str(), ',');
+		if (args == 3)
+			fov = (float)atof(tokens[3].c_str());
+	}
+	else if (name == "mesh" && args >= 2 && args <= 4)
+	{
+		std::unique_ptr<Mesh> mesh(new Mesh());
+		if (!mesh->LoadOBJ(joinPath(base_dir, tokens[1]).c_str()))
+			return false;
+
+		command.type = MESH;
+		command.color = parseColor(tokens[2]);
+		command.spin = args >= 3 ? (float)atof(tokens[3].c_str()) : 0.0f;
+		command.filled = true;
+		if (args == 4)
+		{
+			if (tokens[4] != "wire")
+				return false;
+			command.filled = false;
+		}
+		command.resource = (int)meshes.size();
+		meshes.push_back(std::move(mesh));
+		commands.push_back(command);
+	}
+	else
+		return false;
+
+	return true;
+}
+
+void BatchScene::Init()
+{
+	if (hasParticles)
+		particles.Init(width, height);
+
+	camera.LookAt(eye, center, up);
+	camera.SetPerspective(fov, (float)width / (float)height, 0.01f, 1000.0f);
+
+	// Record every run of static commands
+	lists.clear();
+	for (size_t i = 0; i < commands.size(); ++i)
+	{
+		commands[i].list = -1;
+		if (commands[i].type == PARTICLES || commands[i].type == MESH)
+			continue;
+
+		size_t end = i;
+		DrawList* list = new DrawList();
+		for (; end < commands.size() && commands[end].type != PARTICLES && commands[end].type != MESH; ++end)
+		{
+			const Command& command = commands[end];
+			switch (command.type)
+			{
+				case LINE:
+					list->DrawLineDDA((int)command.p0.x, (int)command.p0.y, (int)command.p1.x, (int)command.p1.y, command.color);
+					break;
+				case RECT:
+					list->DrawRect((int)command.p0.x, (int)command.p0.y, (int)command.p1.x, (int)command.p1.y, command.color, command.border, command.filled, command.fill);
+					break;
+				case TRIANGLE:
+					list->DrawTriangle(command.p0, command.p1, command.p2, command.color, command.filled, command.fill);
+					break;
+				case IMAGE:
+					list->DrawImage(*images[command.resource], (int)command.p0.x, (int)command.p0.y);
+					break;
+				default:
+					break;
+			}
+		}
+
+		commands[i].list = (int)lists.size();
+		commands[i].run_end = (int)end;
+		lists.push_back(std::unique_ptr<DrawList>(list));
+		i = end - 1;
+	}
+}
+
+std::string BatchScene::GetFrameFilename(int frame) const
+{
+	char name[1024];
+	snprintf(name, sizeof(name), output.c_str(), frame);
+	return name;
+}
+
+void BatchScene::RenderFrame(int frame, Image& framebuffer)
+{
+	const float dt = 1.0f / fps;
+	if (hasParticles)
+		particles.Update(dt, width, height);
+
+	framebuffer.Fill(background);
+
+	for (size_t i = 0; i < commands.size(); ++i)
+	{
+		const Command& command = commands[i];
+		switch (command.type)
+		{
+			case LINE:
+			case RECT:
+			case TRIANGLE:
+			case IMAGE:
+				// Replay the run of static commands it starts
+				lists[command.list]->Execute(framebuffer, drawTiled());
+				i = command.run_end - 1;
+				break;
+			case PARTICLES:
+				particles.Render(&framebuffer);
+				break;
+			case MESH:
+				DrawMesh(command, frame * dt, framebuffer);
+				break;
+		}
+	}
+}
+
+// Flat shaded triangles drawn back to front (painter's algorithm), lit from the camera
+void BatchScene::DrawMesh(const Command& command, float time, Image& framebuffer)
+{
+	Matrix44 model;
+	model.MakeRotationMatrix(command.spin * time * DEG2RAD, Vector3(0, 1, 0));
+
+	Vector3 light = eye - center;
+	light.Normalize();
+
+	const std::vector<Vector3>& vertices = meshes[command.resource]->GetVertices();
+	triangles.clear();
+
+	for (size_t i = 0; i + 2 < vertices.size(); i += 3)
+	{
+		Vector3 world[3], ndc[3];
+		bool visible = true;
+		for (int k = 0; k < 3 && visible; ++k)
+		{
+			world[k] = model * vertices[i + k];
+			ndc[k] = camera.ProjectVector(world[k]);
+			visible = ndc[k].z >= -1.0f && ndc[k].z <= 1.0f;
+		}
+		if (!visible)
+			continue;
+
+		MeshTriangle triangle;
+		triangle.p0 = Vector2((ndc[0].x + 1.0f) * 0.5f * width, (ndc[0].y + 1.0f) * 0.5f * height);
+		triangle.p1 = Vector2((ndc[1].x + 1.0f) * 0.5f * width, (ndc[1].y + 1.0f) * 0.5f * height);
+		triangle.p2 = Vector2((ndc[2].x + 1.0f) * 0.5f * width, (ndc[2].y + 1.0f) * 0.5f * height);
+		triangle.depth = ndc[0].z + ndc[1].z + ndc[2].z;
+		triangle.color = command.color;
+
+		if (command.filled)
+		{
+			// Counter-clockwise triangles face the camera
+			float area = (triangle.p1.x - triangle.p0.x) * (triangle.p2.y - triangle.p0.y) - (triangle.p2.x - triangle.p0.x) * (triangle.p1.y - triangle.p0.y);
+			if (area <= 0.0f)
+				continue;
+
+			Vector3 normal = (world[1] - world[0]).Cross(world[2] - world[0]);
+			normal.Normalize();
+			float intensity = 0.25f + 0.75f * std::max(normal.Dot(light), 0.0f);
+			triangle.color = command.color * intensity;
+		}
+
+		triangles.push_back(triangle);
+	}
+
+	if (command.filled)
+		std::sort(triangles.begin(), triangles.end(), [](const MeshTriangle& a, const MeshTriangle& b) { return a.depth > b.depth; });
+
+	mesh_list.Clear();
+	for (size_t i = 0; i < triangles.size(); ++i)
+	{
+		const MeshTriangle& t = triangles[i];
+		mesh_list.DrawTriangle(t.p0, t.p1, t.p2, t.color, command.filled, t.color);
+	}
+	mesh_list.Execute(framebuffer, drawTiled());
+}
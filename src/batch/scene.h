@@ -0,0 +1,109 @@
+/*
+	+ Scene rendered by the batch renderer: a text description loaded from a file, drawn into an Image frame by frame.
+	+ Only uses the CPU framebuffer (raster primitives, particles, meshes projected with a Camera), no window or OpenGL.
+
+	One command per line, '#' starts a comment. Vectors are written without spaces: x,y or x,y,z (colors r,g,b).
+
+		size W H                        Frame size in pixels (default 640 480)
+		frames N                        Number of frames (default 1)
+		fps F                           Frames per second of the animation (default 30)
+		output PATTERN                  printf pattern of the frame files, .png or .tga (default frame_%04d.png)
+		seed N                          Particle seed
+		background R,G,B
+
+		line X0,Y0 X1,Y1 R,G,B
+		rect X,Y W,H R,G,B [BORDER [FILL_R,G,B]]
+		triangle X0,Y0 X1,Y1 X2,Y2 R,G,B [FILL_R,G,B]
+		image FILE X,Y
+
+		particles CAPACITY [pixel|additive|alpha [RADIUS [OPACITY]]]
+		emitter point|line|rect|circle X,Y SIZE_X,SIZE_Y RATE [ANGLE SPREAD [SPEED_MIN,SPEED_MAX [TTL_MIN,TTL_MAX [R,G,B [R,G,B]]]]]
+		gravity X,Y
+		wind X,Y DRAG
+		attractor X,Y STRENGTH [RADIUS]
+		interaction RADIUS STRENGTH
+
+		camera EYE_X,Y,Z CENTER_X,Y,Z [FOV]
+		mesh FILE R,G,B [SPIN [wire]]   SPIN in degrees per second around the Y axis
+
+	Pixel coordinates start at the bottom left corner, angles are in degrees. Drawing commands are executed in file order
+	every frame. Relative file names are relative to the scene file.
+
+	Consecutive line/rect/triangle/image commands never change, they are recorded once in a DrawList and replayed
+	every frame (drawn by tiles in parallel when there are several cores), as are the triangles of each mesh.
+*/
+
+#pragma once
+
+#include "framework/image.h"
+#include "framework/mesh.h"
+#include "framework/camera.h"
+#include "framework/particle_system.h"
+#include "framework/draw_list.h"
+#include <string>
+#include <vector>
+#include <memory>
+
+class BatchScene
+{
+public:
+	int width = 640;
+	int height = 480;
+	int frames = 1;
+	float fps = 30.0f;
+	std::string output = "frame_%04d.png";
+
+	// Parses the scene file, prints the errors with their line. Returns false if the scene can not be rendered.
+	bool Load(const char* filename);
+
+	// Prepares the particles and the draw lists (call after Load and after changing the size)
+	void Init();
+
+	// Advances the animation one frame and draws it (frames must be rendered in order)
+	void RenderFrame(int frame, Image& framebuffer);
+
+	// Name of the file of a frame (output pattern with the frame number)
+	std::string GetFrameFilename(int frame) const;
+
+private:
+	enum CommandType { LINE, RECT, TRIANGLE, IMAGE, PARTICLES, MESH };
+
+	struct Command
+	{
+		CommandType type;
+		Vector2 p0, p1, p2;
+		Color color, fill;
+		int border = 1;
+		bool filled = false;
+		float spin = 0.0f;              // MESH: degrees per second
+		int resource = -1;              // IMAGE/MESH: index in images/meshes
+		int run_end = 0;                // First command of a run of static commands: end of the run, recorded in list
+		int list = -1;
+	};
+
+	// A projected triangle of a mesh
+	struct MeshTriangle
+	{
+		Vector2 p0, p1, p2;
+		float depth;
+		Color color;
+	};
+
+	Color background;
+	std::vector<Command> commands;
+	std::vector<std::unique_ptr<Image>> images;
+	std::vector<std::unique_ptr<Mesh>> meshes;
+	std::vector<MeshTriangle> triangles;    // Scratch of DrawMesh, kept between frames
+	std::vector<std::unique_ptr<DrawList>> lists;
+	DrawList mesh_list;
+
+	ParticleSystem particles;
+	bool hasParticles = false;
+
+	Camera camera;
+	Vector3 eye = Vector3(0, 0, 3), center, up = Vector3(0, 1, 0);
+	float fov = 45.0f;
+
+	bool ParseCommand(const std::vector<std::string>& tokens, const std::string& base_dir);
+	void DrawMesh(const Command& command, float time, Image& framebuffer);
+};
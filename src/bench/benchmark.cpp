@@ -0,0 +1,107 @@
+#include "benchmark.h"
+#include "framework/alloc_stats.h"
+#include <chrono>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <cstdio>
+
+static volatile int s_sink = 0;
+
+std::vector<Benchmark::Entry>& Benchmark::GetEntries()
+{
+	static std::vector<Entry> entries;
+	return entries;
+}
+
+void Benchmark::Register(const std::string& name, Operation operation, double pixels, double bytes)
+{
+	Entry entry = { name, operation, pixels, bytes };
+	GetEntries().push_back(entry);
+}
+
+void Benchmark::Consume(int value)
+{
+	s_sink = s_sink + value;
+}
+
+// Seconds taken by 'iterations' operations
+static double timeOperation(const Benchmark::Operation& operation, long long iterations)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (long long i = 0; i < iterations; ++i)
+		operation();
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+Benchmark::Result Benchmark::Run(const Entry& entry, double min_time, int samples)
+{
+	// Warm up (caches, lazy allocations) and find how many iterations fill a sample
+	long long iterations = 1;
+	double seconds = timeOperation(entry.operation, iterations);
+	while (seconds < min_time && iterations < (1LL << 40))
+	{
+		double scale = seconds > 0.0 ? std::min(min_time * 1.2 / seconds, 10.0) : 10.0;
+		iterations = std::max(iterations + 1, (long long)(iterations * scale));
+		seconds = timeOperation(entry.operation, iterations);
+	}
+
+	std::vector<double> times;
+	times.reserve(samples);
+	uint64_t allocations = AllocStats::GetTotal().allocations;
+	for (int i = 0; i < samples; ++i)
+		times.push_back(timeOperation(entry.operation, iterations) / iterations);
+	allocations = AllocStats::GetTotal().allocations - allocations;
+	std::sort(times.begin(), times.end());
+	double op_seconds = times[times.size() / 2];
+
+	Result result;
+	result.name = entry.name;
+	result.iterations = iterations;
+	result.ns_per_op = op_seconds * 1e9;
+	result.pixels_per_second = entry.pixels > 0.0 ? entry.pixels / op_seconds : 0.0;
+	result.mb_per_second = entry.bytes > 0.0 ? entry.bytes / op_seconds / (1024.0 * 1024.0) : 0.0;
+	result.allocs_per_op = AllocStats::IsAvailable() ? allocations / (double)(iterations * samples) : -1.0;
+	return result;
+}
+
+std::vector<Benchmark::Result> Benchmark::RunAll(const std::string& filter, double min_time, int samples)
+{
+	std::vector<Result> results;
+	printf("%-32s %12s %14s %14s %12s %12s\n", "benchmark", "iterations", "ns/op", "Mpixels/s", "MB/s", "allocs/op");
+
+	const std::vector<Entry>& entries = GetEntries();
+	for (size_t i = 0; i < entries.size(); ++i)
+	{
+		if (!filter.empty() && entries[i].name.find(filter) == std::string::npos)
+			continue;
+
+		Result r = Run(entries[i], min_time, samples);
+		results.push_back(r);
+		char pixels[32] = "-", mb[32] = "-", allocs[32] = "-";
+		if (r.pixels_per_second > 0.0) snprintf(pixels, sizeof(pixels), "%.2f", r.pixels_per_second / 1e6);
+		if (r.mb_per_second > 0.0) snprintf(mb, sizeof(mb), "%.1f", r.mb_per_second);
+		if (r.allocs_per_op >= 0.0) snprintf(allocs, sizeof(allocs), "%.2f", r.allocs_per_op);
+		printf("%-32s %12lld %14.1f %14s %12s %12s\n", r.name.c_str(), r.iterations, r.ns_per_op, pixels, mb, allocs);
+		fflush(stdout);
+	}
+	return results;
+}
+
+std::string Benchmark::ToJSON(const std::vector<Result>& results)
+{
+	std::ostringstream json;
+	json << "{\n\t\"benchmarks\": [\n";
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const Result& r = results[i];
+		json << "\t\t{ \"name\": \"" << r.name << "\", \"iterations\": " << r.iterations
+			<< ", \"ns_per_op\": " << r.ns_per_op
+			<< ", \"pixels_per_second\": " << r.pixels_per_second
+			<< ", \"mb_per_second\": " << r.mb_per_second
+			<< ", \"allocs_per_op\": " << r.allocs_per_op << " }"
+			<< (i + 1 < results.size() ? ",\n" : "\n");
+	}
+	json << "\t]\n}\n";
+	return json.str();
+}
@@ -0,0 +1,49 @@
+/*
+	+ Minimal micro-benchmark harness used by the Benchmarks executable.
+	+ Every benchmark is a function running one operation; it is repeated until it takes long enough to be measured,
+	  several times, and the median is reported (ns per operation, pixels per second and MB per second).
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+
+class Benchmark
+{
+public:
+	typedef std::function<void()> Operation;
+
+	struct Result
+	{
+		std::string name;
+		long long iterations;       // Operations of every sample
+		double ns_per_op;           // Median of the samples
+		double pixels_per_second;   // 0 when the benchmark does not draw
+		double mb_per_second;       // 0 when the benchmark does not move data
+		double allocs_per_op;       // Heap allocations, -1 without CG_ALLOC_STATS
+	};
+
+	// pixels/bytes: work done by one operation (0 = not reported)
+	static void Register(const std::string& name, Operation operation, double pixels = 0.0, double bytes = 0.0);
+
+	// Runs the benchmarks whose name contains filter (empty = all) and prints a table
+	static std::vector<Result> RunAll(const std::string& filter, double min_time, int samples);
+
+	static std::string ToJSON(const std::vector<Result>& results);
+
+	// Keeps the compiler from removing the work of a benchmark
+	static void Consume(int value);
+
+private:
+	struct Entry
+	{
+		std::string name;
+		Operation operation;
+		double pixels, bytes;
+	};
+
+	static std::vector<Entry>& GetEntries();
+	static Result Run(const Entry& entry, double min_time, int samples);
+};
@@ -0,0 +1,391 @@
+/*
+	Micro-benchmarks of the raster, image, filter and math kernels of the framework (headless).
+
+		Benchmarks [--filter NAME] [--json FILE] [--min-time SECONDS] [--samples N] [--res DIR]
+
+	Fixtures are repeatable: random primitives come from fixed seeds and the files are the bundled res/ assets.
+	--json writes the results for regression tracking ("-" prints them).
+*/
+
+#include "benchmark.h"
+#include "framework/image.h"
+#include "framework/image_filters.h"
+#include "framework/mesh.h"
+#include "framework/draw_list.h"
+#include "framework/particle_system.h"
+#include "framework/rng.h"
+#include <iostream>
+#include <fstream>
+#include <memory>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+
+static const int WIDTH = 1280;
+static const int HEIGHT = 720;
+
+#ifndef CG_RES_DIR
+#define CG_RES_DIR "res"
+#endif
+
+static std::string s_res_dir = CG_RES_DIR;
+
+static double fileSize(const std::string& path)
+{
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	return file.is_open() ? (double)file.tellg() : 0.0;
+}
+
+static void registerRaster()
+{
+	// Every operation draws the next primitive of a fixed list
+	const int PRIMITIVES = 1024;
+	std::shared_ptr<Image> framebuffer = std::make_shared<Image>(WIDTH, HEIGHT);
+	std::shared_ptr<std::vector<Vector2>> points = std::make_shared<std::vector<Vector2>>();
+	std::shared_ptr<std::vector<Color>> colors = std::make_shared<std::vector<Color>>();
+
+	Rng rng(42);
+	double line_pixels = 0.0, triangle_pixels = 0.0;
+	for (int i = 0; i < PRIMITIVES; ++i)
+	{
+		Vector2 a(rng.Range(0.0f, (float)WIDTH), rng.Range(0.0f, (float)HEIGHT));
+		Vector2 b(a.x + rng.Range(-200.0f, 200.0f), a.y + rng.Range(-200.0f, 200.0f));
+		Vector2 c(a.x + rng.Range(-200.0f, 200.0f), a.y + rng.Range(-200.0f, 200.0f));
+		points->push_back(a);
+		points->push_back(b);
+		points->push_back(c);
+		colors->push_back(Color((float)(rng.NextUInt() & 255), (float)(rng.NextUInt() & 255), (float)(rng.NextUInt() & 255)));
+
+		line_pixels += std::max(std::abs((int)b.x - (int)a.x), std::abs((int)b.y - (int)a.y)) + 1;
+		triangle_pixels += std::abs((b.x - a.x) * (c.y - a.y) - (c.x - a.x) * (b.y - a.y)) * 0.5;
+	}
+	line_pixels /= PRIMITIVES;
+	triangle_pixels /= PRIMITIVES;
+
+	std::shared_ptr<int> next = std::make_shared<int>(0);
+
+	Benchmark::Register("DrawLineDDA", [framebuffer, points, colors, next]()
+	{
+		int i = (*next)++ & (PRIMITIVES - 1);
+		const Vector2& a = (*points)[i * 3];
+		const Vector2& b = (*points)[i * 3 + 1];
+		framebuffer->DrawLineDDA((int)a.x, (int)a.y, (int)b.x, (int)b.y, (*colors)[i]);
+	}, line_pixels, line_pixels * sizeof(Color));
+
+	Benchmark::Register("DrawRect 200x150 filled", [framebuffer, points, colors, next]()
+	{
+		int i = (*next)++ & (PRIMITIVES - 1);
+		const Vector2& a = (*points)[i * 3];
+		framebuffer->DrawRect((int)a.x - 100, (int)a.y - 75, 200, 150, (*colors)[i], 2, true, (*colors)[(i + 1) & (PRIMITIVES - 1)]);
+	}, 200.0 * 150.0, 200.0 * 150.0 * sizeof(Color));
+
+	Benchmark::Register("DrawTriangle filled", [framebuffer, points, colors, next]()
+	{
+		int i = (*next)++ & (PRIMITIVES - 1);
+		framebuffer->DrawTriangle((*points)[i * 3], (*points)[i * 3 + 1], (*points)[i * 3 + 2], (*colors)[i], true, (*colors)[i]);
+	}, triangle_pixels, triangle_pixels * sizeof(Color));
+
+	Benchmark::Register("DrawTriangle outline", [framebuffer, points, colors, next]()
+	{
+		int i = (*next)++ & (PRIMITIVES - 1);
+		framebuffer->DrawTriangle((*points)[i * 3], (*points)[i * 3 + 1], (*points)[i * 3 + 2], (*colors)[i], false, (*colors)[i]);
+	});
+
+	// Mesh-like triangles of a few pixels
+	std::shared_ptr<std::vector<Vector2>> small = std::make_shared<std::vector<Vector2>>();
+	double small_pixels = 0.0;
+	for (int i = 0; i < PRIMITIVES; ++i)
+	{
+		Vector2 a(rng.Range(0.0f, (float)WIDTH), rng.Range(0.0f, (float)HEIGHT));
+		Vector2 b(a.x + rng.Range(-8.0f, 8.0f), a.y + rng.Range(-8.0f, 8.0f));
+		Vector2 c(a.x + rng.Range(-8.0f, 8.0f), a.y + rng.Range(-8.0f, 8.0f));
+		small->push_back(a);
+		small->push_back(b);
+		small->push_back(c);
+		small_pixels += std::abs((b.x - a.x) * (c.y - a.y) - (c.x - a.x) * (b.y - a.y)) * 0.5;
+	}
+	small_pixels /= PRIMITIVES;
+
+	Benchmark::Register("DrawTriangle small filled", [framebuffer, small, colors, next]()
+	{
+		int i = (*next)++ & (PRIMITIVES - 1);
+		framebuffer->DrawTriangle((*small)[i * 3], (*small)[i * 3 + 1], (*small)[i * 3 + 2], (*colors)[i], true, (*colors)[i]);
+	}, small_pixels, small_pixels * sizeof(Color));
+
+	// The same 1024 small triangles drawn directly, and replayed from a recorded list (in order and by tiles)
+	Benchmark::Register("DrawTriangle small x1024 direct", [framebuffer, small, colors]()
+	{
+		for (int i = 0; i < PRIMITIVES; ++i)
+			framebuffer->DrawTriangle((*small)[i * 3], (*small)[i * 3 + 1], (*small)[i * 3 + 2], (*colors)[i], true, (*colors)[i]);
+	}, small_pixels * PRIMITIVES, small_pixels * PRIMITIVES * sizeof(Color));
+
+	std::shared_ptr<DrawList> list = std::make_shared<DrawList>();
+	for (int i = 0; i < PRIMITIVES; ++i)
+		list->DrawTriangle((*small)[i * 3], (*small)[i * 3 + 1], (*small)[i * 3 + 2], (*colors)[i], true, (*colors)[i]);
+
+	Benchmark::Register("DrawList small x1024 serial", [framebuffer, list]()
+	{
+		list->Execute(*framebuffer, false);
+	}, small_pixels * PRIMITIVES, small_pixels * PRIMITIVES * sizeof(Color));
+
+	Benchmark::Register("DrawList small x1024 tiled", [framebuffer, list]()
+	{
+		list->Execute(*framebuffer, true);
+	}, small_pixels * PRIMITIVES, small_pixels * PRIMITIVES * sizeof(Color));
+
+	Benchmark::Register("DrawList record+tiled x1024", [framebuffer, small, colors]()
+	{
+		static DrawList recorded;
+		recorded.Clear();
+		for (int i = 0; i < PRIMITIVES; ++i)
+			recorded.DrawTriangle((*small)[i * 3], (*small)[i * 3 + 1], (*small)[i * 3 + 2], (*colors)[i], true, (*colors)[i]);
+		recorded.Execute(*framebuffer, true);
+	}, small_pixels * PRIMITIVES, small_pixels * PRIMITIVES * sizeof(Color));
+}
+
+static void registerImage()
+{
+	const double pixels = (double)WIDTH * HEIGHT;
+	std::shared_ptr<Image> image = std::make_shared<Image>(WIDTH, HEIGHT);
+
+	Benchmark::Register("Fill 1280x720", [image]()
+	{
+		image->Fill(Color(10, 20, 30));
+		Benchmark::Consume(image->pixels[0].r);
+	}, pixels, pixels * sizeof(Color));
+
+	// Up and back down, so every operation starts from the same image
+	const double scaled_pixels = 1920.0 * 1080.0 + pixels;
+	Benchmark::Register("Scale 1280x720<->1920x1080", [image]()
+	{
+		image->Scale(1920, 1080);
+		image->Scale(WIDTH, HEIGHT);
+	}, scaled_pixels, scaled_pixels * sizeof(Color));
+
+	// Filters on a 4K frame: per pixel callbacks and row spans (vectorized loops over the bytes)
+	const double frame_pixels = 3840.0 * 2160.0;
+	std::shared_ptr<Image> frame = std::make_shared<Image>(3840, 2160);
+	std::shared_ptr<Image> frame2 = std::make_shared<Image>(3840, 2160);
+	frame2->Fill(Color(200, 100, 50));
+
+	Benchmark::Register("ForEachPixel invert 4K", [frame]()
+	{
+		frame->ForEachPixel([](Color c) { return Color(255 - c.r, 255 - c.g, 255 - c.b); });
+	}, frame_pixels, frame_pixels * sizeof(Color) * 2);
+
+	Benchmark::Register("ForEachPixelParallel invert 4K", [frame]()
+	{
+		frame->ForEachPixelParallel([](Color c) { return Color(255 - c.r, 255 - c.g, 255 - c.b); });
+	}, frame_pixels, frame_pixels * sizeof(Color) * 2);
+
+	Benchmark::Register("ForEachRowParallel invert 4K", [frame]()
+	{
+		frame->ForEachRowParallel([](Color* row, unsigned int width, unsigned int)
+		{
+			unsigned char* v = row->v;
+			for (unsigned int i = 0; i < width * 3; ++i)
+				v[i] = 255 - v[i];
+		});
+	}, frame_pixels, frame_pixels * sizeof(Color) * 2);
+
+	Benchmark::Register("ForEachPixel blend 4K", [frame, frame2]()
+	{
+		ForEachPixel(*frame, *frame2, [](Color a, Color b) { return Color((a.r + b.r) / 2, (a.g + b.g) / 2, (a.b + b.b) / 2); });
+	}, frame_pixels, frame_pixels * sizeof(Color) * 3);
+
+	Benchmark::Register("ForEachRowParallel blend 4K", [frame, frame2]()
+	{
+		ForEachRowParallel(*frame, *frame2, [](Color* row, const Color* row2, unsigned int width, unsigned int)
+		{
+			unsigned char* a = row->v;
+			const unsigned char* b = row2->v;
+			for (unsigned int i = 0; i < width * 3; ++i)
+				a[i] = (unsigned char)((a[i] + b[i]) >> 1);
+		});
+	}, frame_pixels, frame_pixels * sizeof(Color) * 3);
+
+	std::string png = s_res_dir + "/images/fruits.png";
+	Image probe;
+	if (probe.LoadPNG(png.c_str()))
+	{
+		Benchmark::Register("LoadPNG fruits.png", [png]()
+		{
+			Image loaded;
+			loaded.LoadPNG(png.c_str());
+			Benchmark::Consume(loaded.width);
+		}, (double)probe.width * probe.height, fileSize(png));
+	}
+
+	std::string obj = s_res_dir + "/meshes/lee.obj";
+	if (fileSize(obj) > 0.0)
+	{
+		Benchmark::Register("LoadOBJ lee.obj", [obj]()
+		{
+			Mesh mesh;
+			mesh.LoadOBJ(obj.c_str());
+			Benchmark::Consume((int)mesh.GetVertices().size());
+		}, 0.0, fileSize(obj));
+	}
+}
+
+static void registerFilters()
+{
+	// 1080p frame with gradients and noise, filtered into a second image
+	const int width = 1920, height = 1080;
+	const double pixels = (double)width * height;
+	std::shared_ptr<Image> source = std::make_shared<Image>(width, height);
+	std::shared_ptr<Image> result = std::make_shared<Image>(width, height);
+	Rng rng(11);
+	for (int y = 0; y < height; ++y)
+		for (int x = 0; x < width; ++x)
+			source->SetPixelUnsafe(x, y, Color((float)(x * 255 / width), (float)(y * 255 / height), rng.Range(0.0f, 255.0f)));
+
+	Benchmark::Register("BoxBlur 1080p r=2", [source, result]()
+	{
+		ImageFilters::BoxBlur(*source, *result, 2);
+	}, pixels, pixels * sizeof(Color) * 2);
+
+	Benchmark::Register("BoxBlur 1080p r=20", [source, result]()
+	{
+		ImageFilters::BoxBlur(*source, *result, 20);
+	}, pixels, pixels * sizeof(Color) * 2);
+
+	std::shared_ptr<std::vector<float>> gaussian = std::make_shared<std::vector<float>>(ImageFilters::GetGaussianKernel(6.0f));
+	Benchmark::Register("ConvolveSeparable 1080p 37 taps", [source, result, gaussian]()
+	{
+		ImageFilters::ConvolveSeparable(*source, *result, *gaussian);
+	}, pixels, pixels * sizeof(Color) * 2);
+
+	Benchmark::Register("GaussianBlur 1080p sigma=6", [source, result]()
+	{
+		ImageFilters::GaussianBlur(*source, *result, 6.0f);
+	}, pixels, pixels * sizeof(Color) * 2);
+
+	Benchmark::Register("Sharpen 1080p", [source, result]()
+	{
+		ImageFilters::Sharpen(*source, *result);
+	}, pixels, pixels * sizeof(Color) * 2);
+
+	Benchmark::Register("Sobel 1080p", [source, result]()
+	{
+		ImageFilters::Sobel(*source, *result);
+	}, pixels, pixels * sizeof(Color) * 2);
+
+	Benchmark::Register("Median 1080p r=1", [source, result]()
+	{
+		ImageFilters::Median(*source, *result, 1);
+	}, pixels, pixels * sizeof(Color) * 2);
+
+	Benchmark::Register("Median 1080p r=3", [source, result]()
+	{
+		ImageFilters::Median(*source, *result, 3);
+	}, pixels, pixels * sizeof(Color) * 2);
+}
+
+static void registerMath()
+{
+	// Chain of rotations (stays bounded, each product depends on the previous one)
+	std::shared_ptr<Matrix44> result = std::make_shared<Matrix44>();
+	std::shared_ptr<Matrix44> rotation = std::make_shared<Matrix44>();
+	result->SetIdentity();
+	rotation->MakeRotationMatrix(0.01f, Vector3(0.3f, 0.8f, 0.5f).Normalize());
+
+	Benchmark::Register("Matrix44 multiply", [result, rotation]()
+	{
+		*result = *result * *rotation;
+		Benchmark::Consume((int)result->m[0]);
+	}, 0.0, 3 * sizeof(Matrix44));
+
+	std::shared_ptr<std::vector<Vector3>> vectors = std::make_shared<std::vector<Vector3>>(1024);
+	Rng rng(7);
+	for (size_t i = 0; i < vectors->size(); ++i)
+		(*vectors)[i] = Vector3(rng.NextFloat(), rng.NextFloat(), rng.NextFloat());
+
+	Benchmark::Register("Matrix44 * Vector3 x1024", [rotation, vectors]()
+	{
+		float sum = 0.0f;
+		for (size_t i = 0; i < vectors->size(); ++i)
+			sum += (*rotation * (*vectors)[i]).x;
+		Benchmark::Consume((int)sum);
+	}, 0.0, 1024.0 * sizeof(Vector3));
+}
+
+static void registerParticles(int count)
+{
+	std::shared_ptr<ParticleSystem> particles = std::make_shared<ParticleSystem>();
+	particles->SetSeed(1);
+	particles->SetCapacity(count);
+	particles->Init(WIDTH, HEIGHT);
+
+	std::shared_ptr<Image> framebuffer = std::make_shared<Image>(WIDTH, HEIGHT);
+	std::string suffix = " " + std::to_string(count / 1000) + "k";
+
+	// The starfield keeps the system full, every update moves every particle
+	Benchmark::Register("ParticleSystem::Update" + suffix, [particles]()
+	{
+		particles->Update(1.0f / 60.0f, WIDTH, HEIGHT);
+	}, 0.0, (double)count * (7 * sizeof(float) + sizeof(Color)));
+
+	Benchmark::Register("ParticleSystem::Render" + suffix, [particles, framebuffer]()
+	{
+		particles->Render(framebuffer.get());
+	}, (double)count, (double)count * sizeof(Color));
+}
+
+static void printUsage()
+{
+	std::cout << "Usage: Benchmarks [--filter NAME] [--json FILE] [--min-time SECONDS] [--samples N] [--res DIR]" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+	std::string filter, json_file;
+	double min_time = 0.2;
+	int samples = 5;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		bool has_value = i + 1 < argc;
+		if (arg == "--filter" && has_value) filter = argv[++i];
+		else if (arg == "--json" && has_value) json_file = argv[++i];
+		else if (arg == "--min-time" && has_value) min_time = atof(argv[++i]);
+		else if (arg == "--samples" && has_value) samples = std::max(atoi(argv[++i]), 1);
+		else if (arg == "--res" && has_value) s_res_dir = argv[++i];
+		else
+		{
+			printUsage();
+			return 1;
+		}
+	}
+
+	// The loaders report every file, keep the table readable
+	std::streambuf* cout_buffer = std::cout.rdbuf(NULL);
+
+	registerRaster();
+	registerImage();
+	registerFilters();
+	registerMath();
+	registerParticles(10000);
+	registerParticles(100000);
+
+	std::vector<Benchmark::Result> results = Benchmark::RunAll(filter, min_time, samples);
+
+	std::cout.rdbuf(cout_buffer);
+	std::cout.clear();
+
+	if (json_file == "-")
+		std::cout << Benchmark::ToJSON(results);
+	else if (!json_file.empty())
+	{
+		std::ofstream file(json_file);
+		if (!file.is_open())
+		{
+			std::cerr << "--- Failed to save file: " << json_file << std::endl;
+			return 1;
+		}
+		file << Benchmark::ToJSON(results);
+		std::cout << "+++ File saved: " << json_file << std::endl;
+	}
+	return 0;
+}
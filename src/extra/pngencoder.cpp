@@ -0,0 +1,789 @@
+#include "pngencoder.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+// Small PNG encoder with its own deflate implementation (LZ77 with hash chains + dynamic Huffman blocks).
+// Image rows are split in chunks that are filtered and compressed in parallel, every chunk but the last one
+// ends with an empty stored block so that the byte aligned outputs can be concatenated in one zlib stream.
+
+namespace
+{
+	const unsigned short LENBASE[29] = { 3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258 };
+	const unsigned char LENEXTRA[29] = { 0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0 };
+	const unsigned short DISTBASE[30] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577 };
+	const unsigned char DISTEXTRA[30] = { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
+	const unsigned char CLCL[19] = { 16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15 }; // Code length code order
+
+	const unsigned int MIN_MATCH = 3;
+	const unsigned int MAX_MATCH = 258;
+	const unsigned int WINDOW_SIZE = 32768;
+	const unsigned int WINDOW_MASK = WINDOW_SIZE - 1;
+	const unsigned int HASH_BITS = 15;
+	const size_t BLOCK_SYMBOLS = 1 << 15; // Symbols per dynamic Huffman block
+
+	// Match finder settings for each compression level (same meaning as in zlib)
+	struct LevelConfig
+	{
+		unsigned int good_length; // Reduce the chain search once the previous match is this long
+		unsigned int max_lazy;    // Lazy: skip the search after a match this long. Greedy: max length that inserts all positions
+		unsigned int nice_length; // Stop searching once a match this long is found
+		unsigned int max_chain;   // Max hash chain entries visited
+		bool lazy;                // Check if the next position gives a longer match
+	};
+
+	const LevelConfig LEVELS[10] = {
+		{ 0, 0, 0, 0, false },
+		{ 4, 4, 8, 4, false }, { 4, 5, 16, 8, false }, { 4, 6, 32, 32, false },
+		{ 4, 4, 16, 16, true }, { 8, 16, 32, 32, true }, { 8, 16, 128, 128, true },
+		{ 8, 32, 128, 256, true }, { 32, 128, 258, 1024, true }, { 32, 258, 258, 4096, true }
+	};
+
+	// Lookup tables built once
+	struct Tables
+	{
+		unsigned char len_code[MAX_MATCH + 1]; // Match length -> length code (0..28)
+		unsigned char dist_code[512];          // Distance -> distance code (see DistCode)
+		uint32_t crc[256];
+
+		Tables()
+		{
+			for (int c = 0; c < 29; ++c)
+				for (unsigned int l = LENBASE[c]; l < LENBASE[c] + (1u << LENEXTRA[c]) && l <= MAX_MATCH; ++l)
+					len_code[l] = (unsigned char)c;
+			len_code[MAX_MATCH] = 28;
+
+			for (int c = 0; c < 30; ++c)
+				for (unsigned int d = DISTBASE[c]; d < DISTBASE[c] + (1u << DISTEXTRA[c]); ++d)
+				{
+					if (d <= 256) dist_code[d - 1] = (unsigned char)c;
+					else dist_code[256 + ((d - 1) >> 7)] = (unsigned char)c;
+				}
+
+			for (uint32_t n = 0; n < 256; ++n)
+			{
+				uint32_t c = n;
+				for (int k = 0; k < 8; ++k)
+					c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+				crc[n] = c;
+			}
+		}
+
+		unsigned int DistCode(unsigned int dist) const { return dist <= 256 ? dist_code[dist - 1] : dist_code[256 + ((dist - 1) >> 7)]; }
+	};
+
+	const Tables& GetTables()
+	{
+		static const Tables tables;
+		return tables;
+	}
+
+	uint32_t Crc32(uint32_t crc, const unsigned char* data, size_t size)
+	{
+		const uint32_t* table = GetTables().crc;
+		crc = ~crc;
+		for (size_t i = 0; i < size; ++i)
+			crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+		return ~crc;
+	}
+
+	const uint32_t ADLER_BASE = 65521;
+
+	uint32_t Adler32(const unsigned char* data, size_t size)
+	{
+		uint32_t s1 = 1, s2 = 0;
+		while (size > 0)
+		{
+			size_t n = std::min(size, (size_t)5552); // Max bytes before s2 can overflow
+			size -= n;
+			for (size_t i = 0; i < n; ++i)
+			{
+				s1 += data[i];
+				s2 += s1;
+			}
+			data += n;
+			s1 %= ADLER_BASE;
+			s2 %= ADLER_BASE;
+		}
+		return (s2 << 16) | s1;
+	}
+
+	// Checksum of the concatenation of two buffers given their checksums (same as zlib adler32_combine)
+	uint32_t Adler32Combine(uint32_t adler1, uint32_t adler2, size_t len2)
+	{
+		uint32_t rem = (uint32_t)(len2 % ADLER_BASE);
+		uint32_t sum1 = adler1 & 0xFFFF;
+		uint32_t sum2 = (rem * sum1) % ADLER_BASE;
+		sum1 += (adler2 & 0xFFFF) + ADLER_BASE - 1;
+		sum2 += (adler1 >> 16) + (adler2 >> 16) + ADLER_BASE - rem;
+		if (sum1 >= ADLER_BASE) sum1 -= ADLER_BASE;
+		if (sum1 >= ADLER_BASE) sum1 -= ADLER_BASE;
+		if (sum2 >= (ADLER_BASE << 1)) sum2 -= (ADLER_BASE << 1);
+		if (sum2 >= ADLER_BASE) sum2 -= ADLER_BASE;
+		return sum1 | (sum2 << 16);
+	}
+
+	void PushU32BE(std::vector<unsigned char>& out, uint32_t v)
+	{
+		out.push_back((unsigned char)(v >> 24));
+		out.push_back((unsigned char)(v >> 16));
+		out.push_back((unsigned char)(v >> 8));
+		out.push_back((unsigned char)v);
+	}
+
+	// Appends a full PNG chunk (length, type, data, crc)
+	void WriteChunk(std::vector<unsigned char>& out, const char* type, const unsigned char* data, size_t size)
+	{
+		PushU32BE(out, (uint32_t)size);
+		size_t start = out.size();
+		out.insert(out.end(), type, type + 4);
+		if (size) out.insert(out.end(), data, data + size);
+		PushU32BE(out, Crc32(0, &out[start], size + 4));
+	}
+
+	// LSB first bit writer as required by deflate
+	struct BitWriter
+	{
+		std::vector<unsigned char>& out;
+		uint64_t bits;
+		unsigned int count;
+
+		explicit BitWriter(std::vector<unsigned char>& o) : out(o), bits(0), count(0) {}
+
+		inline void Put(uint32_t value, unsigned int nbits)
+		{
+			bits |= (uint64_t)value << count;
+			count += nbits;
+			if (count >= 32)
+			{
+				unsigned char b[4] = { (unsigned char)bits, (unsigned char)(bits >> 8), (unsigned char)(bits >> 16), (unsigned char)(bits >> 24) };
+				out.insert(out.end(), b, b + 4);
+				bits >>= 32;
+				count -= 32;
+			}
+		}
+
+		void Align()
+		{
+			while (count > 0)
+			{
+				out.push_back((unsigned char)bits);
+				bits >>= 8;
+				count = count > 8 ? count - 8 : 0;
+			}
+			bits = 0;
+		}
+	};
+
+	// Computes Huffman code lengths limited to max_bits (frequencies are flattened until the tree fits)
+	void BuildLengths(const uint32_t* freq_in, int n, unsigned int max_bits, unsigned char* lengths)
+	{
+		std::vector<uint32_t> freq(freq_in, freq_in + n);
+		std::vector<int> order;
+		std::vector<uint32_t> weight;
+		std::vector<int> parent, depth;
+
+		while (true)
+		{
+			memset(lengths, 0, n);
+			order.clear();
+			for (int i = 0; i < n; ++i)
+				if (freq[i]) order.push_back(i);
+
+			if (order.empty()) return;
+			if (order.size() == 1) { lengths[order[0]] = 1; return; }
+
+			std::sort(order.begin(), order.end(), [&](int a, int b) { return freq[a] != freq[b] ? freq[a] < freq[b] : a < b; });
+
+			// Two queue Huffman construction: leaves are sorted, internal nodes are created in increasing weight
+			int leaves = (int)order.size();
+			weight.assign(2 * leaves, 0);
+			parent.assign(2 * leaves, -1);
+			for (int i = 0; i < leaves; ++i)
+				weight[i] = freq[order[i]];
+
+			int next_leaf = 0, next_node = leaves, created = leaves;
+			while (created < 2 * leaves - 1)
+			{
+				int pick[2];
+				for (int k = 0; k < 2; ++k)
+				{
+					if (next_leaf < leaves && (next_node >= created || weight[next_leaf] <= weight[next_node]))
+						pick[k] = next_leaf++;
+					else
+						pick[k] = next_node++;
+				}
+				weight[created] = weight[pick[0]] + weight[pick[1]];
+				parent[pick[0]] = parent[pick[1]] = created;
+				++created;
+			}
+
+			// Parents always have a bigger index than their children
+			depth.assign(created, 0);
+			unsigned int max_depth = 0;
+			for (int i = created - 2; i >= 0; --i)
+				depth[i] = depth[parent[i]] + 1;
+			for (int i = 0; i < leaves; ++i)
+			{
+				lengths[order[i]] = (unsigned char)depth[i];
+				max_depth = std::max(max_depth, (unsigned int)depth[i]);
+			}
+
+			if (max_depth <= max_bits) return;
+			for (size_t i = 0; i < freq.size(); ++i)
+				if (freq[i]) freq[i] = (freq[i] >> 1) | 1;
+		}
+	}
+
+	// Canonical codes (already bit reversed to be written LSB first)
+	void BuildCodes(const unsigned char* lengths, int n, uint16_t* codes)
+	{
+		unsigned int bl_count[16] = { 0 };
+		unsigned int next_code[16] = { 0 };
+		for (int i = 0; i < n; ++i)
+			bl_count[lengths[i]]++;
+		bl_count[0] = 0;
+
+		unsigned int code = 0;
+		for (int bits = 1; bits < 16; ++bits)
+		{
+			code = (code + bl_count[bits - 1]) << 1;
+			next_code[bits] = code;
+		}
+
+		for (int i = 0; i < n; ++i)
+		{
+			unsigned int len = lengths[i];
+			codes[i] = 0;
+			if (!len) continue;
+			unsigned int c = next_code[len]++, r = 0;
+			for (unsigned int b = 0; b < len; ++b)
+				r |= ((c >> b) & 1) << (len - 1 - b);
+			codes[i] = (uint16_t)r;
+		}
+	}
+
+	// Makes sure at least two codes are used, some decoders do not accept degenerated trees
+	void EnsureTwoCodes(uint32_t* freq, int n)
+	{
+		int used = 0;
+		for (int i = 0; i < n; ++i)
+			if (freq[i]) ++used;
+		for (int i = 0; i < n && used < 2; ++i)
+			if (!freq[i]) { freq[i] = 1; ++used; }
+	}
+
+	// Compresses one chunk of data as a sequence of deflate blocks
+	class Deflater
+	{
+		// Literal (dist == 0) or match (litlen = length)
+		struct Symbol
+		{
+			uint16_t litlen;
+			uint16_t dist;
+		};
+
+		const unsigned char* data;
+		size_t size;
+		LevelConfig config;
+		BitWriter writer;
+
+		std::vector<uint32_t> head; // Last position + 1 for each hash (0 = empty)
+		std::vector<uint32_t> prev; // Previous position + 1 with the same hash
+
+		std::vector<Symbol> symbols;
+		uint32_t lit_freq[286];
+		uint32_t dist_freq[30];
+		size_t block_start;  // First byte covered by the current block
+		size_t emitted;      // Bytes already converted to symbols
+
+	public:
+		Deflater(const unsigned char* data, size_t size, int level, std::vector<unsigned char>& out)
+			: data(data), size(size), config(LEVELS[level]), writer(out), block_start(0), emitted(0)
+		{
+			memset(lit_freq, 0, sizeof(lit_freq));
+			memset(dist_freq, 0, sizeof(dist_freq));
+		}
+
+		void Compress(bool last)
+		{
+			if (config.max_chain == 0)
+				WriteStored(0, size, last);
+			else
+			{
+				head.assign(1 << HASH_BITS, 0);
+				prev.assign(WINDOW_SIZE, 0);
+				symbols.reserve(BLOCK_SYMBOLS);
+				Parse();
+				FlushBlock(last);
+			}
+
+			// Sync flush: empty stored block leaves the stream byte aligned for the next chunk
+			if (!last && config.max_chain != 0)
+				WriteStored(size, size, false);
+			writer.Align();
+		}
+
+	private:
+		inline uint32_t Hash(size_t p) const
+		{
+			uint32_t v = data[p] | (data[p + 1] << 8) | (data[p + 2] << 16);
+			return (v * 2654435761u) >> (32 - HASH_BITS);
+		}
+
+		inline void Insert(size_t p)
+		{
+			uint32_t h = Hash(p);
+			prev[p & WINDOW_MASK] = head[h];
+			head[h] = (uint32_t)(p + 1);
+		}
+
+		// Longest match for position p (must be called before inserting p)
+		unsigned int FindMatch(size_t p, unsigned int prev_length, unsigned int& best_dist) const
+		{
+			unsigned int max_len = (unsigned int)std::min((size_t)MAX_MATCH, size - p);
+			unsigned int best = prev_length >= MIN_MATCH ? prev_length : 0;
+			unsigned int chain = prev_length >= config.good_length ? config.max_chain >> 2 : config.max_chain;
+			unsigned int found = 0;
+			uint32_t cand = head[Hash(p)];
+			if (best >= max_len) return 0;
+
+			while (cand && chain--)
+			{
+				size_t c = cand - 1;
+				if (p - c > WINDOW_SIZE) break;
+
+				if (data[c + best] == data[p + best] && data[c] == data[p])
+				{
+					unsigned int l = MatchLength(data + c, data + p, max_len);
+					if (l > best)
+					{
+						best = found = l;
+						best_dist = (unsigned int)(p - c);
+						if (l >= config.nice_length || l >= max_len) break;
+					}
+				}
+
+				uint32_t next = prev[c & WINDOW_MASK];
+				if (next >= cand) break;
+				cand = next;
+			}
+			return found >= MIN_MATCH ? found : 0;
+		}
+
+		// Number of equal bytes (up to max_len), compared 8 at a time
+		static inline unsigned int MatchLength(const unsigned char* a, const unsigned char* b, unsigned int max_len)
+		{
+			unsigned int l = 0;
+			while (l + 8 <= max_len)
+			{
+				uint64_t va, vb;
+				memcpy(&va, a + l, 8);
+				memcpy(&vb, b + l, 8);
+				if (va != vb) break;
+				l += 8;
+			}
+			while (l < max_len && a[l] == b[l]) ++l;
+			return l;
+		}
+
+		inline void EmitLiteral(unsigned char b)
+		{
+			Symbol s = { b, 0 };
+			symbols.push_back(s);
+			lit_freq[b]++;
+			emitted++;
+			if (symbols.size() >= BLOCK_SYMBOLS) FlushBlock(false);
+		}
+
+		inline void EmitMatch(unsigned int len, unsigned int dist)
+		{
+			const Tables& t = GetTables();
+			Symbol s = { (uint16_t)len, (uint16_t)dist };
+			symbols.push_back(s);
+			lit_freq[257 + t.len_code[len]]++;
+			dist_freq[t.DistCode(dist)]++;
+			emitted += len;
+			if (symbols.size() >= BLOCK_SYMBOLS) FlushBlock(false);
+		}
+
+		void Parse()
+		{
+			size_t pos = 0;
+			unsigned int prev_len = 0, prev_dist = 0;
+			bool pending = false; // data[pos - 1] still has to be emitted (lazy mode)
+
+			while (pos < size)
+			{
+				unsigned int len = 0, dist = 0;
+				if (pos + MIN_MATCH <= size)
+				{
+					if (!config.lazy)
+						len = FindMatch(pos, 0, dist);
+					else if (prev_len < config.max_lazy)
+						len = FindMatch(pos, prev_len, dist);
+					Insert(pos);
+				}
+
+				if (!config.lazy)
+				{
+					if (len)
+					{
+						EmitMatch(len, dist);
+						// Long matches are not inserted in the hash table to go faster
+						if (len <= config.max_lazy)
+							for (size_t k = pos + 1; k < pos + len; ++k)
+								if (k + MIN_MATCH <= size) Insert(k);
+						pos += len;
+					}
+					else
+						EmitLiteral(data[pos++]);
+					continue;
+				}
+
+				if (prev_len >= MIN_MATCH && len <= prev_len)
+				{
+					// The match that starts in the previous position wins
+					EmitMatch(prev_len, prev_dist);
+					size_t end = pos - 1 + prev_len;
+					for (size_t k = pos + 1; k < end; ++k)
+						if (k + MIN_MATCH <= size) Insert(k);
+					pos = end;
+					prev_len = 0;
+					pending = false;
+				}
+				else
+				{
+					if (pending) EmitLiteral(data[pos - 1]);
+					pending = true;
+					prev_len = len;
+					prev_dist = dist;
+					++pos;
+				}
+			}
+
+			if (pending) EmitLiteral(data[pos - 1]);
+		}
+
+		void WriteStored(size_t start, size_t end, bool final)
+		{
+			size_t pos = start;
+			do
+			{
+				size_t n = std::min(end - pos, (size_t)65535);
+				writer.Put(final && pos + n == end ? 1 : 0, 1);
+				writer.Put(0, 2);
+				writer.Align();
+				std::vector<unsigned char>& out = writer.out;
+				out.push_back((unsigned char)n);
+				out.push_back((unsigned char)(n >> 8));
+				out.push_back((unsigned char)~n);
+				out.push_back((unsigned char)(~n >> 8));
+				if (n) out.insert(out.end(), data + pos, data + pos + n);
+				pos += n;
+			} while (pos < end);
+		}
+
+		void FlushBlock(bool final)
+		{
+			const Tables& t = GetTables();
+
+			lit_freq[256] = 1; // End of block
+			EnsureTwoCodes(lit_freq, 286);
+			EnsureTwoCodes(dist_freq, 30);
+
+			unsigned char lit_len[286], dist_len[30];
+			uint16_t lit_code[286], dist_code[30];
+			BuildLengths(lit_freq, 286, 15, lit_len);
+			BuildLengths(dist_freq, 30, 15, dist_len);
+
+			int hlit = 286, hdist = 30;
+			while (hlit > 257 && !lit_len[hlit - 1]) --hlit;
+			while (hdist > 1 && !dist_len[hdist - 1]) --hdist;
+
+			// Run length encode the code lengths of both trees (symbols 16, 17 and 18 are repetitions)
+			unsigned char all[286 + 30];
+			memcpy(all, lit_len, hlit);
+			memcpy(all + hlit, dist_len, hdist);
+			int total = hlit + hdist;
+
+			unsigned char cl_sym[286 + 30], cl_extra[286 + 30];
+			int cl_count = 0;
+			uint32_t cl_freq[19] = { 0 };
+			for (int i = 0; i < total;)
+			{
+				unsigned char v = all[i];
+				int run = 1;
+				while (i + run < total && all[i + run] == v) ++run;
+				i += run;
+
+				if (v == 0)
+				{
+					while (run >= 11) { int r = std::min(run, 138); cl_sym[cl_count] = 18; cl_extra[cl_count++] = (unsigned char)(r - 11); run -= r; }
+					if (run >= 3) { cl_sym[cl_count] = 17; cl_extra[cl_count++] = (unsigned char)(run - 3); run = 0; }
+				}
+				else
+				{
+					cl_sym[cl_count] = v; cl_extra[cl_count++] = 0; run--;
+					while (run >= 3) { int r = std::min(run, 6); cl_sym[cl_count] = 16; cl_extra[cl_count++] = (unsigned char)(r - 3); run -= r; }
+				}
+				while (run-- > 0) { cl_sym[cl_count] = v; cl_extra[cl_count++] = 0; }
+			}
+			for (int i = 0; i < cl_count; ++i)
+				cl_freq[cl_sym[i]]++;
+			EnsureTwoCodes(cl_freq, 19);
+
+			unsigned char cl_len[19];
+			uint16_t cl_code[19];
+			BuildLengths(cl_freq, 19, 7, cl_len);
+			BuildCodes(cl_len, 19, cl_code);
+
+			int hclen = 19;
+			while (hclen > 4 && !cl_len[CLCL[hclen - 1]]) --hclen;
+
+			// Compare the dynamic block size with a stored block
+			uint64_t dyn_bits = 3 + 5 + 5 + 4 + 3 * hclen;
+			for (int i = 0; i < cl_count; ++i)
+				dyn_bits += cl_len[cl_sym[i]] + (cl_sym[i] == 16 ? 2 : cl_sym[i] == 17 ? 3 : cl_sym[i] == 18 ? 7 : 0);
+			for (int i = 0; i < 286; ++i)
+				dyn_bits += (uint64_t)lit_freq[i] * (lit_len[i] + (i >= 257 ? LENEXTRA[i - 257] : 0));
+			for (int i = 0; i < 30; ++i)
+				dyn_bits += (uint64_t)dist_freq[i] * (dist_len[i] + DISTEXTRA[i]);
+
+			size_t raw = emitted - block_start;
+			uint64_t stored_bits = (uint64_t)raw * 8 + ((raw / 65535) + 1) * (3 + 7 + 32);
+
+			if (stored_bits < dyn_bits)
+				WriteStored(block_start, emitted, final);
+			else
+			{
+				BuildCodes(lit_len, 286, lit_code);
+				BuildCodes(dist_len, 30, dist_code);
+
+				writer.Put(final ? 1 : 0, 1);
+				writer.Put(2, 2); // Dynamic Huffman
+				writer.Put(hlit - 257, 5);
+				writer.Put(hdist - 1, 5);
+				writer.Put(hclen - 4, 4);
+				for (int i = 0; i < hclen; ++i)
+					writer.Put(cl_len[CLCL[i]], 3);
+				for (int i = 0; i < cl_count; ++i)
+				{
+					writer.Put(cl_code[cl_sym[i]], cl_len[cl_sym[i]]);
+					if (cl_sym[i] == 16) writer.Put(cl_extra[i], 2);
+					else if (cl_sym[i] == 17) writer.Put(cl_extra[i], 3);
+					else if (cl_sym[i] == 18) writer.Put(cl_extra[i], 7);
+				}
+
+				for (size_t i = 0; i < symbols.size(); ++i)
+				{
+					const Symbol& s = symbols[i];
+					if (s.dist == 0)
+					{
+						writer.Put(lit_code[s.litlen], lit_len[s.litlen]);
+						continue;
+					}
+					unsigned int lc = t.len_code[s.litlen];
+					writer.Put(lit_code[257 + lc], lit_len[257 + lc]);
+					if (LENEXTRA[lc]) writer.Put(s.litlen - LENBASE[lc], LENEXTRA[lc]);
+					unsigned int dc = t.DistCode(s.dist);
+					writer.Put(dist_code[dc], dist_len[dc]);
+					if (DISTEXTRA[dc]) writer.Put(s.dist - DISTBASE[dc], DISTEXTRA[dc]);
+				}
+				writer.Put(lit_code[256], lit_len[256]);
+			}
+
+			symbols.clear();
+			memset(lit_freq, 0, sizeof(lit_freq));
+			memset(dist_freq, 0, sizeof(dist_freq));
+			block_start = emitted;
+		}
+	};
+
+	inline unsigned char Paeth(int a, int b, int c)
+	{
+		int p = a + b - c;
+		int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+		if (pa <= pb && pa <= pc) return (unsigned char)a;
+		return (unsigned char)(pb <= pc ? b : c);
+	}
+
+	// Applies PNG filter 'type' to a row (prev is NULL for the first row of the image)
+	void ApplyFilter(int type, unsigned char* dst, const unsigned char* row, const unsigned char* prev, unsigned int row_bytes, unsigned int bpp)
+	{
+		unsigned int head = std::min(bpp, row_bytes);
+		switch (type)
+		{
+		case 0:
+			memcpy(dst, row, row_bytes);
+			break;
+		case 1:
+			memcpy(dst, row, head);
+			for (unsigned int i = bpp; i < row_bytes; ++i) dst[i] = (unsigned char)(row[i] - row[i - bpp]);
+			break;
+		case 2:
+			if (!prev) { memcpy(dst, row, row_bytes); break; }
+			for (unsigned int i = 0; i < row_bytes; ++i) dst[i] = (unsigned char)(row[i] - prev[i]);
+			break;
+		case 3:
+			for (unsigned int i = 0; i < head; ++i) dst[i] = (unsigned char)(row[i] - ((prev ? prev[i] : 0) >> 1));
+			for (unsigned int i = bpp; i < row_bytes; ++i) dst[i] = (unsigned char)(row[i] - ((row[i - bpp] + (prev ? prev[i] : 0)) >> 1));
+			break;
+		default:
+			if (!prev) { ApplyFilter(1, dst, row, prev, row_bytes, bpp); break; } // Paeth(a, 0, 0) = a
+			for (unsigned int i = 0; i < head; ++i) dst[i] = (unsigned char)(row[i] - prev[i]);
+			for (unsigned int i = bpp; i < row_bytes; ++i) dst[i] = (unsigned char)(row[i] - Paeth(row[i - bpp], prev[i], prev[i - bpp]));
+			break;
+		}
+	}
+
+	// Writes filter byte + filtered row, picking the filter with the smallest sum of absolute values
+	void FilterRow(unsigned char* dst, const unsigned char* row, const unsigned char* prev, unsigned int row_bytes, unsigned int bpp, int level, std::vector<unsigned char>& scratch)
+	{
+		if (level == 0)
+		{
+			dst[0] = 0;
+			memcpy(dst + 1, row, row_bytes);
+			return;
+		}
+
+		// Fast levels only try Sub and Up, default levels add Paeth
+		static const int FAST[] = { 1, 2 };
+		static const int DEFAULT[] = { 1, 2, 4 };
+		static const int ALL[] = { 0, 1, 2, 3, 4 };
+		const int* types = level <= 3 ? FAST : level <= 6 ? DEFAULT : ALL;
+		int num_types = level <= 3 ? 2 : level <= 6 ? 3 : 5;
+
+		scratch.resize(row_bytes);
+		uint64_t best_sum = UINT64_MAX;
+		for (int t = 0; t < num_types; ++t)
+		{
+			ApplyFilter(types[t], &scratch[0], row, prev, row_bytes, bpp);
+			uint64_t sum = 0;
+			for (unsigned int i = 0; i < row_bytes; ++i)
+				sum += scratch[i] < 128 ? scratch[i] : 256 - scratch[i];
+			if (sum < best_sum)
+			{
+				best_sum = sum;
+				dst[0] = (unsigned char)types[t];
+				memcpy(dst + 1, &scratch[0], row_bytes);
+			}
+		}
+	}
+
+	// Result of compressing a group of rows
+	struct Chunk
+	{
+		unsigned int first_row;
+		unsigned int num_rows;
+		std::vector<unsigned char> idat; // Complete IDAT chunk
+		uint32_t adler;
+		size_t raw_size;
+	};
+}
+
+int encodePNG(std::vector<unsigned char>& out_png, const unsigned char* image, unsigned int image_width, unsigned int image_height, unsigned int channels, int level, unsigned int num_threads, bool flip_y, const std::function<void(float)>& progress)
+{
+	if (!image || image_width == 0 || image_height == 0) return 1;
+	if (channels != 3 && channels != 4) return 2;
+	level = std::max(0, std::min(level, 9));
+
+	GetTables(); // Build the tables before the workers start
+
+	const unsigned int row_bytes = image_width * channels;
+	const size_t filtered_row = (size_t)row_bytes + 1;
+
+	if (num_threads == 0)
+		num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+	// Split rows in chunks (at least 256KB each so the sync flush overhead stays negligible)
+	size_t total = filtered_row * image_height;
+	size_t target = std::max((size_t)(256 * 1024), total / (num_threads * 4));
+	unsigned int rows_per_chunk = (unsigned int)std::max((size_t)1, target / filtered_row);
+	unsigned int num_chunks = (image_height + rows_per_chunk - 1) / rows_per_chunk;
+
+	std::vector<Chunk> chunks(num_chunks);
+	for (unsigned int i = 0; i < num_chunks; ++i)
+	{
+		chunks[i].first_row = i * rows_per_chunk;
+		chunks[i].num_rows = std::min(rows_per_chunk, image_height - chunks[i].first_row);
+	}
+
+	auto row_ptr = [&](unsigned int y) { return image + (size_t)(flip_y ? image_height - 1 - y : y) * row_bytes; };
+
+	std::atomic<unsigned int> next_chunk(0);
+	std::atomic<unsigned int> rows_done(0);
+	auto worker = [&](bool report)
+	{
+		std::vector<unsigned char> filtered, scratch, deflated;
+		for (unsigned int i = next_chunk++; i < num_chunks; i = next_chunk++)
+		{
+			Chunk& chunk = chunks[i];
+			filtered.resize(filtered_row * chunk.num_rows);
+			for (unsigned int r = 0; r < chunk.num_rows; ++r)
+			{
+				unsigned int y = chunk.first_row + r;
+				FilterRow(&filtered[r * filtered_row], row_ptr(y), y ? row_ptr(y - 1) : NULL, row_bytes, channels, level, scratch);
+			}
+
+			chunk.raw_size = filtered.size();
+			chunk.adler = Adler32(&filtered[0], filtered.size());
+
+			deflated.clear();
+			Deflater deflater(&filtered[0], filtered.size(), level, deflated);
+			deflater.Compress(i == num_chunks - 1);
+
+			WriteChunk(chunk.idat, "IDAT", &deflated[0], deflated.size());
+
+			// Only the calling thread reports, so the values never go back
+			unsigned int done = rows_done += chunk.num_rows;
+			if (report && progress)
+				progress(done / (float)image_height);
+		}
+	};
+
+	unsigned int num_workers = std::min(num_threads, num_chunks);
+	std::vector<std::thread> threads;
+	for (unsigned int i = 1; i < num_workers; ++i)
+		threads.push_back(std::thread(worker, false));
+	worker(true);
+	for (size_t i = 0; i < threads.size(); ++i)
+		threads[i].join();
+	if (progress)
+		progress(1.0f);
+
+	// Assemble the file: signature, header, zlib header, compressed chunks, adler32, end
+	static const unsigned char SIGNATURE[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+	out_png.clear();
+	out_png.insert(out_png.end(), SIGNATURE, SIGNATURE + 8);
+
+	unsigned char ihdr[13];
+	std::vector<unsigned char> tmp;
+	PushU32BE(tmp, image_width);
+	PushU32BE(tmp, image_height);
+	memcpy(ihdr, &tmp[0], 8);
+	ihdr[8] = 8;                      // Bit depth
+	ihdr[9] = channels == 4 ? 6 : 2;  // Color type (RGBA or RGB)
+	ihdr[10] = ihdr[11] = ihdr[12] = 0; // Compression, filter, interlace
+	WriteChunk(out_png, "IHDR", ihdr, sizeof(ihdr));
+
+	unsigned char zlib_header[2] = { 0x78, (unsigned char)(level == 0 ? 0x01 : level < 6 ? 0x5E : level == 6 ? 0x9C : 0xDA) };
+	WriteChunk(out_png, "IDAT", zlib_header, 2);
+
+	uint32_t adler = 1;
+	for (unsigned int i = 0; i < num_chunks; ++i)
+	{
+		out_png.insert(out_png.end(), chunks[i].idat.begin(), chunks[i].idat.end());
+		adler = Adler32Combine(adler, chunks[i].adler, chunks[i].raw_size);
+	}
+
+	tmp.clear();
+	PushU32BE(tmp, adler);
+	WriteChunk(out_png, "IDAT", &tmp[0], 4);
+	WriteChunk(out_png, "IEND", NULL, 0);
+
+	return 0;
+}
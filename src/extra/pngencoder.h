@@ -0,0 +1,12 @@
+#pragma once
+
+#include <vector>
+#include <functional>
+#include <string.h>
+
+// Encodes 8-bit RGB (channels = 3) or RGBA (channels = 4) pixels into a PNG file stored in out_png.
+// level: 0 (stored, no compression) to 9 (smallest output). num_threads: 0 uses the hardware concurrency.
+// Rows are compressed in independent blocks that are concatenated into a single zlib stream (pigz style).
+// If flip_y is true the rows of image are written bottom-up. Returns 0 on success.
+// progress (optional) receives the fraction of rows compressed (never decreasing, 1 at the end), always from the calling thread.
+int encodePNG(std::vector<unsigned char>& out_png, const unsigned char* image, unsigned int image_width, unsigned int image_height, unsigned int channels, int level = 6, unsigned int num_threads = 0, bool flip_y = false, const std::function<void(float)>& progress = std::function<void(float)>());
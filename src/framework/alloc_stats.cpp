@@ -0,0 +1,89 @@
+#include "alloc_stats.h"
+#include <atomic>
+#include <new>
+#include <cstdlib>
+
+static std::atomic<uint64_t> s_allocations(0);
+static std::atomic<uint64_t> s_frees(0);
+static std::atomic<uint64_t> s_bytes(0);
+
+static AllocStats::Frame s_last_total;
+static AllocStats::Frame s_last_frame;
+
+bool AllocStats::IsAvailable()
+{
+#ifdef CG_ALLOC_STATS
+	return true;
+#else
+	return false;
+#endif
+}
+
+AllocStats::Frame AllocStats::GetTotal()
+{
+	Frame total;
+	total.allocations = s_allocations.load(std::memory_order_relaxed);
+	total.frees = s_frees.load(std::memory_order_relaxed);
+	total.bytes = s_bytes.load(std::memory_order_relaxed);
+	return total;
+}
+
+void AllocStats::EndFrame()
+{
+	Frame total = GetTotal();
+	s_last_frame.allocations = total.allocations - s_last_total.allocations;
+	s_last_frame.frees = total.frees - s_last_total.frees;
+	s_last_frame.bytes = total.bytes - s_last_total.bytes;
+	s_last_total = total;
+}
+
+const AllocStats::Frame& AllocStats::GetLastFrame()
+{
+	return s_last_frame;
+}
+
+#ifdef CG_ALLOC_STATS
+
+// Replacements of the global allocation functions (the array and nothrow versions of the standard library
+// call these ones, the aligned ones are left alone)
+
+static void* countedAlloc(size_t size)
+{
+	s_allocations.fetch_add(1, std::memory_order_relaxed);
+	s_bytes.fetch_add(size, std::memory_order_relaxed);
+	return malloc(size ? size : 1);
+}
+
+static void countedFree(void* ptr)
+{
+	if (!ptr)
+		return;
+	s_frees.fetch_add(1, std::memory_order_relaxed);
+	free(ptr);
+}
+
+void* operator new(size_t size)
+{
+	void* ptr = countedAlloc(size);
+	if (!ptr)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void* operator new[](size_t size)
+{
+	void* ptr = countedAlloc(size);
+	if (!ptr)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return countedAlloc(size); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return countedAlloc(size); }
+
+void operator delete(void* ptr) noexcept { countedFree(ptr); }
+void operator delete[](void* ptr) noexcept { countedFree(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { countedFree(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { countedFree(ptr); }
+
+#endif
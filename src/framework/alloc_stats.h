@@ -0,0 +1,29 @@
+/*
+	+ Heap allocation counters: with CG_ALLOC_STATS the global operator new/delete are replaced by versions that count
+	  every allocation (any thread). Without it the counters stay at 0.
+	+ EndFrame takes the counts since the previous frame (the profiler calls it once per frame and shows them in the HUD).
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+class AllocStats
+{
+public:
+	struct Frame
+	{
+		uint64_t allocations = 0;
+		uint64_t frees = 0;
+		uint64_t bytes = 0;         // Allocated
+	};
+
+	static bool IsAvailable();      // Compiled with CG_ALLOC_STATS
+
+	// Counts since the program started
+	static Frame GetTotal();
+
+	// Counts since the last EndFrame, then starts a new frame
+	static void EndFrame();
+	static const Frame& GetLastFrame();
+};
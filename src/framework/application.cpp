@@ -2,6 +2,9 @@
 #include "mesh.h"
 #include "shader.h"
 #include "utils.h" 
+#include "image_loader.h"
+#include "image_saver.h"
+#include "profiler.h"
 
 Application::Application(const char* caption, int width, int height)
 {
@@ -27,6 +30,8 @@ void Application::Init(void)
 {
 	std::cout << "Initiating app..." << std::endl;
 
+	SetPresentMode(present_mode);
+
 	// Clear canvas and store a base copy for previews
 	framebuffer.Fill(Color::BLACK);
 	tempbuffer = framebuffer;
@@ -58,13 +63,48 @@ void Application::Init(void)
 		BTN_BLACK, BTN_WHITE, BTN_PINK, BTN_YELLOW, BTN_RED, BTN_BLUE, BTN_CYAN
 	};
 
-	int toolbarIndexX = 10;
+	toolbarIconsPending = imagePaths.size();
 
 	for (size_t i = 0; i < imagePaths.size(); ++i)
 	{
-		// Create button and place it in a horizontal row
-		toolbarButtons.emplace_back(imagePaths[i], Vector2(toolbarIndexX, 10), buttonTypes[i]);
-		toolbarIndexX += toolbarButtons.back().GetImage().width + 10;
+		// Create the button now and decode its icon in the background
+		toolbarButtons.emplace_back(Vector2(10, 10), buttonTypes[i]);
+
+		ImageLoader::GetAsync(imagePaths[i], [this, i](std::shared_ptr<const Image> image)
+		{
+			if (image)
+			{
+				toolbarButtons[i].SetImage(image);
+				LayoutToolbar();
+			}
+			if (--toolbarIconsPending == 0)
+				BuildToolbarAtlas();
+		}, true);
+	}
+}
+
+void Application::BuildToolbarAtlas()
+{
+	for (size_t i = 0; i < toolbarButtons.size(); ++i)
+		if (toolbarButtons[i].GetImage().pixels)
+			toolbarAtlas.Add(std::to_string(i), toolbarButtons[i].GetSharedImage());
+
+	if (!toolbarAtlas.Build())
+		return;
+
+	for (size_t i = 0; i < toolbarButtons.size(); ++i)
+		toolbarButtons[i].SetAtlasRegion(&toolbarAtlas, toolbarAtlas.Find(std::to_string(i)));
+}
+
+void Application::LayoutToolbar()
+{
+	// Place the buttons in a horizontal row (buttons without icon yet take no space)
+	int toolbarIndexX = 10;
+	for (Button& b : toolbarButtons)
+	{
+		b.SetPosition(Vector2((float)toolbarIndexX, 10));
+		if (b.GetImage().width)
+			toolbarIndexX += b.GetImage().width + 10;
 	}
 }
 
@@ -72,6 +112,8 @@ void Application::Init(void)
 // Render one frame
 void Application::Render(void)
 {
+	PROFILE_SCOPE("Application::Render");
+
 	// In animation mode we clear every frame; in paint mode we keep the canvas
 	if (mode == MODE_ANIMATION)
 		framebuffer.Fill(Color::BLACK);
@@ -83,23 +125,73 @@ void Application::Render(void)
 	for (Button& b : toolbarButtons)
 		b.Render(framebuffer);
 
+	// Progress of the saves running in the background (one bar per save, as many as fit in the toolbar)
+	std::vector<ImageSaver::SaveStatus> saves = ImageSaver::GetActiveSaves();
+	for (size_t i = 0; i < saves.size() && i < 5; ++i)
+	{
+		int y = 8 + (int)i * 8;
+		int progress = (int)(100 * saves[i].progress);
+		framebuffer.DrawRect(window_width - 110, y, 100, 6, Color::WHITE, 1, false, Color::WHITE);
+		if (progress > 0)
+			framebuffer.DrawRect(window_width - 110, y, progress, 6, Color::GREEN, 1, true, Color::GREEN);
+	}
+
 	// Draw particles only in animation mode
 	if (mode == MODE_ANIMATION)
-		particleSystem.Render(&framebuffer);
+		particleSystem.Render(&framebuffer, interpolation_alpha);
+
+	// Send framebuffer to screen (with the profiler HUD on top, removed afterwards so it never ends up in the canvas)
+	Profiler* profiler = Profiler::Get();
+	if (profiler->IsHUDVisible())
+		profiler->DrawHUD(framebuffer);
 
-	// Send framebuffer to screen
 	framebuffer.Render();
+
+	if (profiler->IsHUDVisible())
+		profiler->EraseHUD(framebuffer);
 }
 
 
 // Called after render
 void Application::Update(float seconds_elapsed)
 {
+	PROFILE_SCOPE("Application::Update");
+
 	// Update particles using dt (seconds)
 	if (mode == MODE_ANIMATION)
 		particleSystem.Update(seconds_elapsed, window_width, window_height);
 }
 
+void Application::Publish(void)
+{
+	particleSystem.Publish();
+}
+
+void Application::SetPresentMode(PresentMode mode)
+{
+	present_mode = mode;
+	int interval = mode == PRESENT_VSYNC ? 1 : (mode == PRESENT_ADAPTIVE ? -1 : 0);
+	if (SDL_GL_SetSwapInterval(interval) != 0 && mode == PRESENT_ADAPTIVE)
+	{
+		std::cout << "Adaptive vsync not supported, using vsync" << std::endl;
+		present_mode = PRESENT_VSYNC;
+		SDL_GL_SetSwapInterval(1);
+	}
+}
+
+bool Application::NeedsFrame()
+{
+	// Animations, background work (loading icons, save progress bars) and the profiler HUD keep drawing
+	return needs_redraw || mode == MODE_ANIMATION || ImageLoader::GetPendingLoads() > 0 || ImageSaver::GetPendingSaves() > 0
+		|| Profiler::Get()->IsHUDVisible();
+}
+
+void Application::SetPipelined(bool enabled)
+{
+	pipelined = enabled;
+	particleSystem.SetDoubleBuffered(enabled);
+}
+
 //keyboard press event 
 void Application::OnKeyPressed(SDL_KeyboardEvent event)
 {
@@ -124,6 +216,37 @@ void Application::OnKeyPressed(SDL_KeyboardEvent event)
 		particleSystem.Init(window_width, window_height);
 		break;
 
+	case SDLK_b:
+		// Cycle particle drawing: pixels, additive splats, alpha splats
+		particleSystem.SetBlendMode((ParticleSystem::BlendMode)((particleSystem.GetBlendMode() + 1) % 3), 2.0f, 0.6f);
+		break;
+
+	case SDLK_p:
+		// Toggle update/render pipelining
+		SetPipelined(!pipelined);
+		std::cout << "Pipelined update: " << (pipelined ? "on" : "off") << std::endl;
+		break;
+
+	case SDLK_v:
+	{
+		// Cycle present mode: immediate, vsync, adaptive vsync
+		const char* names[] = { "immediate", "vsync", "adaptive vsync" };
+		SetPresentMode((PresentMode)((present_mode + 1) % 3));
+		std::cout << "Present mode: " << names[present_mode] << std::endl;
+		break;
+	}
+
+	case SDLK_h:
+		// Toggle the profiler HUD (scopes are only recorded while it is visible)
+		Profiler::Get()->SetHUDVisible(!Profiler::Get()->IsHUDVisible());
+		Profiler::Get()->SetEnabled(Profiler::Get()->IsHUDVisible());
+		break;
+
+	case SDLK_t:
+		// Save the recorded scopes (open in chrome://tracing or ui.perfetto.dev)
+		Profiler::Get()->SaveTrace("profile_trace.json");
+		break;
+
 	case SDLK_f:
 		// Toggle fill for rect/triangle
 		isFilled = !isFilled;
@@ -261,12 +384,19 @@ void Application::HandleButton(ButtonType type)
 		break;
 
 	case BTN_LOAD:
-		framebuffer.LoadPNG("images/fruits.png"); // example
-		tempbuffer = framebuffer;
+		// Decoded in the background (only the first time), the canvas is replaced when ready
+		ImageLoader::GetAsync("images/fruits.png", [this](std::shared_ptr<const Image> image)
+		{
+			if (!image)
+				return;
+			framebuffer = *image;
+			tempbuffer = framebuffer;
+		}, true);
 		break;
 
 	case BTN_SAVE:
-		framebuffer.SaveTGA("images/out.tga");
+		// Snapshot now, encode and write in the background
+		ImageSaver::SaveAsync(framebuffer, "images/out.tga");
 		break;
 
 	default: break;
@@ -274,46 +404,48 @@ void Application::HandleButton(ButtonType type)
 }
 
 
-void Application::OnMouseMove(SDL_MouseButtonEvent event)
+void Application::OnMouseMove(const std::vector<Vector2>& path)
 {
 	// Dragging: pencil/eraser draws segments, line/rect uses preview
 	if (!mouseDown) return;
 	if (mode != MODE_PAINT) return;
 	if (clickedOnToolbarButton) return;
+	if (path.empty()) return;
 
 	if (tool == TOOL_PENCIL || tool == TOOL_ERASER)
 	{
 		Color c = (tool == TOOL_ERASER) ? Color::BLACK : drawingColor;
 
-		// First move just sets the start point
+		// The stroke starts where the button was pressed
 		if (lastMousePosition.x < 0 || lastMousePosition.y < 0)
+			lastMousePosition = startPos;
+
+		// Every position of the frame in one batch (tempbuffer is updated once, on mouse up)
+		for (const Vector2& p : path)
 		{
-			lastMousePosition = mouse_position;
-			return;
+			framebuffer.DrawLineDDA((int)lastMousePosition.x, (int)lastMousePosition.y, (int)p.x, (int)p.y, c);
+			lastMousePosition = p;
 		}
-
-		framebuffer.DrawLineDDA((int)lastMousePosition.x, (int)lastMousePosition.y,
-			(int)mouse_position.x, (int)mouse_position.y, c);
-
-		lastMousePosition = mouse_position;
-		tempbuffer = framebuffer;
 		return;
 	}
 
-	// Preview tools: restore base canvas and draw temporary shape
+	if (tool != TOOL_LINE && tool != TOOL_RECT) return;
+
+	// Preview tools: restore base canvas and draw temporary shape (only at the latest position)
+	const Vector2& pos = path.back();
 	framebuffer = tempbuffer;
 
 	if (tool == TOOL_LINE)
 	{
 		framebuffer.DrawLineDDA((int)startPos.x, (int)startPos.y,
-			(int)mouse_position.x, (int)mouse_position.y, drawingColor);
+			(int)pos.x, (int)pos.y, drawingColor);
 	}
 	else if (tool == TOOL_RECT)
 	{
 		int x0 = (int)startPos.x;
 		int y0 = (int)startPos.y;
-		int x1 = (int)mouse_position.x;
-		int y1 = (int)mouse_position.y;
+		int x1 = (int)pos.x;
+		int y1 = (int)pos.y;
 
 		int rx = std::min(x0, x1);
 		int ry = std::min(y0, y1);
@@ -23,6 +23,30 @@ public:
 
 	float time;
 
+	// Simulation timestep (seconds). launchLoop calls Update with fixed_dt as many times as needed to catch up
+	// with the real time (at most max_substeps per frame). 0 calls Update once per frame with the frame time.
+	float fixed_dt = 1.0f / 60.0f;
+	int max_substeps = 8;
+	float interpolation_alpha = 1.0f; // Fraction of a step between the last Update and now (used to render)
+
+	// Pipelined: launchLoop runs the Update of the next frame in a worker thread while this frame is rendered.
+	// Update must then only change state that Render does not read directly (Render uses what Publish copies).
+	bool pipelined = false;
+	void SetPipelined(bool enabled);
+
+	// Frame pacing
+	enum PresentMode { PRESENT_IMMEDIATE, PRESENT_VSYNC, PRESENT_ADAPTIVE };
+	PresentMode present_mode = PRESENT_VSYNC;
+	void SetPresentMode(PresentMode mode);  // Adaptive vsync falls back to vsync when the driver does not support it
+
+	float max_fps = 0.0f;                   // Frame rate cap (0 = no cap)
+
+	// Idle: launchLoop sleeps until the next event when no frame is needed (see NeedsFrame)
+	bool idle_wait = true;
+	bool needs_redraw = true;               // Something changed since the last frame
+	void RequestRedraw() { needs_redraw = true; }
+	bool NeedsFrame();
+
 	// Input (updated by the framework main loop)
 	const Uint8* keystate;
 	int mouse_state;          // Which mouse buttons are pressed
@@ -32,7 +56,7 @@ public:
 	void OnKeyPressed(SDL_KeyboardEvent event);
 	void OnMouseButtonDown(SDL_MouseButtonEvent event);
 	void OnMouseButtonUp(SDL_MouseButtonEvent event);
-	void OnMouseMove(SDL_MouseButtonEvent event);
+	void OnMouseMove(const std::vector<Vector2>& path); // Positions of all the motions since the last call (oldest first)
 	void OnWheel(SDL_MouseWheelEvent event);
 	void OnFileChanged(const char* filename);
 
@@ -55,6 +79,10 @@ public:
 	std::vector<Button> toolbarButtons;
 	bool clickedOnToolbarButton = false;
 
+	// All the toolbar icons packed in one image (built once every icon is loaded)
+	ImageAtlas toolbarAtlas;
+	size_t toolbarIconsPending = 0;
+
 	// Base canvas for previews (line/rect)
 	Image tempbuffer;
 
@@ -75,6 +103,12 @@ public:
 	// Toolbar action handler
 	void HandleButton(ButtonType type);
 
+	// Places the toolbar icons in a row (icons are loaded in the background)
+	void LayoutToolbar();
+
+	// Packs the loaded icons in toolbarAtlas and makes the buttons draw from it
+	void BuildToolbarAtlas();
+
 	// Constructor and main methods
 	Application(const char* caption, int width, int height);
 	~Application();
@@ -83,6 +117,9 @@ public:
 	void Render(void);
 	void Update(float dt);
 
+	// Hands the state computed by Update to Render (called by launchLoop while no Update is running)
+	void Publish(void);
+
 	// Other methods to control the app
 	void SetWindowSize(int width, int height) {
 		glViewport(0, 0, width, height);
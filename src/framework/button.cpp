@@ -1,10 +1,12 @@
 #include "button.h"
+#include "image_cache.h"
 #include <iostream>
 
 Button::Button(const char* filename, const Vector2& position, ButtonType type)
 {
-    // Load icon (check return value)
-    if (!image.LoadPNG(filename))
+    // Load icon (shared with other buttons using the same file)
+    image = ImageCache::Get(filename, true);
+    if (!image)
         std::cout << "Error loading button image: " << filename << std::endl;
 
     // Top-left position in framebuffer coords
@@ -14,18 +16,35 @@ Button::Button(const char* filename, const Vector2& position, ButtonType type)
     this->type = type;
 }
 
+Button::Button(const Vector2& position, ButtonType type)
+{
+    this->position = position;
+    this->type = type;
+}
+
 void Button::Render(Image& framebuffer) const
 {
-    // Draw icon
-    if (image.pixels)
-        framebuffer.DrawImage(image, (int)position.x, (int)position.y);
+    // Draw icon (from the shared atlas when there is one)
+    if (atlas && atlasRegion >= 0)
+    {
+        const ImageAtlas::Region& r = atlas->GetRegion(atlasRegion);
+        framebuffer.DrawImage(atlas->GetImage(), (int)position.x, (int)position.y, r.x, r.y, r.width, r.height);
+    }
+    else if (image && image->pixels)
+        framebuffer.DrawImage(*image, (int)position.x, (int)position.y);
+}
+
+const Image& Button::GetImage() const
+{
+    static const Image empty;
+    return image ? *image : empty;
 }
 
 bool Button::IsMouseInside(const Vector2& mousePosition) const
 {
     // Point vs rect hit test
     return mousePosition.x >= position.x &&
-        mousePosition.x < (position.x + (float)image.width) &&
+        mousePosition.x < (position.x + (float)GetImage().width) &&
         mousePosition.y >= position.y &&
-        mousePosition.y < (position.y + (float)image.height);
+        mousePosition.y < (position.y + (float)GetImage().height);
 }
@@ -1,5 +1,7 @@
 #pragma once
 #include "image.h"
+#include "image_atlas.h"
+#include <memory>
 
 // Toolbar button ids (tool/color/actions)
 enum ButtonType
@@ -27,18 +29,27 @@ enum ButtonType
 class Button
 {
 private:
-    Image image;          // Icon image (size = clickable area)
+    std::shared_ptr<const Image> image; // Icon image shared through the ImageCache (size = clickable area)
     Vector2 position;     // Top-left position in framebuffer coords
     ButtonType type;      // What this button does
 
+    const ImageAtlas* atlas = nullptr; // If set, the icon is drawn from this atlas region
+    int atlasRegion = -1;
+
 public:
     Button() = default;
     Button(const char* filename, const Vector2& position, ButtonType type);
+    Button(const Vector2& position, ButtonType type); // Icon is set later (see SetImage)
 
     void Render(Image& framebuffer) const;
     bool IsMouseInside(const Vector2& mousePosition) const;
 
-    const Image& GetImage() const { return image; } // Avoid copying Image
+    const Image& GetImage() const; // Avoid copying Image (empty image until the icon is set)
+    std::shared_ptr<const Image> GetSharedImage() const { return image; }
     ButtonType GetType() const { return type; }
     Vector2 GetPosition() const { return position; }
+
+    void SetImage(std::shared_ptr<const Image> image) { this->image = image; }
+    void SetAtlasRegion(const ImageAtlas* atlas, int region) { this->atlas = atlas; this->atlasRegion = region; }
+    void SetPosition(const Vector2& position) { this->position = position; }
 };
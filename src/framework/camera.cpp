@@ -139,6 +139,7 @@ Matrix44 Camera::GetViewProjectionMatrix()
 // The following methods have been created for testing.
 // Do not modify them.
 
+#ifndef CG_HEADLESS
 void Camera::SetExampleViewMatrix()
 {
 	glMatrixMode(GL_MODELVIEW);
@@ -160,3 +161,48 @@ void Camera::SetExampleProjectionMatrix()
 	glGetFloatv(GL_PROJECTION_MATRIX, projection_matrix.m );
 	glMatrixMode(GL_MODELVIEW);
 }
+#else
+// Headless: same matrices as gluLookAt, gluPerspective and glOrtho, computed on the CPU
+
+void Camera::SetExampleViewMatrix()
+{
+	Vector3 f = center - eye;
+	f.Normalize();
+	Vector3 s = f.Cross(up);
+	s.Normalize();
+	Vector3 u = s.Cross(f);
+
+	view_matrix.SetIdentity();
+	view_matrix.M[0][0] = s.x; view_matrix.M[1][0] = s.y; view_matrix.M[2][0] = s.z;
+	view_matrix.M[0][1] = u.x; view_matrix.M[1][1] = u.y; view_matrix.M[2][1] = u.z;
+	view_matrix.M[0][2] = -f.x; view_matrix.M[1][2] = -f.y; view_matrix.M[2][2] = -f.z;
+	view_matrix.M[3][0] = -s.Dot(eye);
+	view_matrix.M[3][1] = -u.Dot(eye);
+	view_matrix.M[3][2] = f.Dot(eye);
+}
+
+void Camera::SetExampleProjectionMatrix()
+{
+	projection_matrix.Clear();
+
+	if (type == PERSPECTIVE)
+	{
+		float f = 1.0f / tanf(fov * DEG2RAD * 0.5f);
+		projection_matrix.M[0][0] = f / aspect;
+		projection_matrix.M[1][1] = f;
+		projection_matrix.M[2][2] = (far_plane + near_plane) / (near_plane - far_plane);
+		projection_matrix.M[2][3] = -1.0f;
+		projection_matrix.M[3][2] = 2.0f * far_plane * near_plane / (near_plane - far_plane);
+	}
+	else
+	{
+		projection_matrix.M[0][0] = 2.0f / (right - left);
+		projection_matrix.M[1][1] = 2.0f / (top - bottom);
+		projection_matrix.M[2][2] = -2.0f / (far_plane - near_plane);
+		projection_matrix.M[3][0] = -(right + left) / (right - left);
+		projection_matrix.M[3][1] = -(top + bottom) / (top - bottom);
+		projection_matrix.M[3][2] = -(far_plane + near_plane) / (far_plane - near_plane);
+		projection_matrix.M[3][3] = 1.0f;
+	}
+}
+#endif
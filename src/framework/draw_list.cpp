@@ -0,0 +1,230 @@
+#include "draw_list.h"
+#include "task_scheduler.h"
+#include "profiler.h"
+#include <climits>
+
+const int DrawList::DEFAULT_TILE_SIZE;
+
+// No clip area: big enough for any image, small enough to add a size without overflowing
+static const Image::ClipRect NO_CLIP = { INT_MIN / 4, INT_MIN / 4, INT_MAX / 4, INT_MAX / 4 };
+
+static Image::ClipRect intersect(const Image::ClipRect& a, const Image::ClipRect& b)
+{
+	Image::ClipRect r = { std::max(a.x0, b.x0), std::max(a.y0, b.y0), std::min(a.x1, b.x1), std::min(a.y1, b.y1) };
+	return r;
+}
+
+static bool isEmpty(const Image::ClipRect& r)
+{
+	return r.x0 >= r.x1 || r.y0 >= r.y1;
+}
+
+DrawList::DrawList(int tile_size) : tile_size(std::max(tile_size, 8)), clip(NO_CLIP)
+{
+}
+
+void DrawList::Clear()
+{
+	commands.clear();
+	clip = NO_CLIP;
+	bins_valid = false;
+}
+
+void DrawList::SetClipRect(int x, int y, int w, int h)
+{
+	Image::ClipRect area = { x, y, x + std::max(w, 0), y + std::max(h, 0) };
+	clip = area;
+}
+
+void DrawList::ResetClipRect()
+{
+	clip = NO_CLIP;
+}
+
+// Stores the command with the area it can draw, [x0, x1) x [y0, y1)
+void DrawList::Add(Command& command, int x0, int y0, int x1, int y1)
+{
+	Image::ClipRect bounds = { x0, y0, x1, y1 };
+	command.clip = clip;
+	command.bounds = intersect(bounds, clip);
+	commands.push_back(command);
+	bins_valid = false;
+}
+
+void DrawList::DrawLineDDA(int x0, int y0, int x1, int y1, const Color& c)
+{
+	Command command = Command();
+	command.type = LINE;
+	command.x = x0; command.y = y0; command.w = x1; command.h = y1;
+	command.color = c;
+
+	// One pixel of margin, the DDA steps are floats
+	Add(command, std::min(x0, x1) - 1, std::min(y0, y1) - 1, std::max(x0, x1) + 2, std::max(y0, y1) + 2);
+}
+
+void DrawList::DrawRect(int x, int y, int w, int h, const Color& borderColor, int borderWidth, bool isFilled, const Color& fillColor)
+{
+	Command command = Command();
+	command.type = RECT;
+	command.x = x; command.y = y; command.w = w; command.h = h;
+	command.border_width = borderWidth;
+	command.filled = isFilled;
+	command.color = borderColor;
+	command.fill_color = fillColor;
+
+	// Borders wider than half the rect are drawn outside it
+	if (w < 0) { x += w + 1; w = -w; }
+	if (h < 0) { y += h + 1; h = -h; }
+	int border = std::max(borderWidth, 1);
+	Add(command, x - border, y - border, x + w + border, y + h + border);
+}
+
+void DrawList::DrawTriangle(const Vector2& p0, const Vector2& p1, const Vector2& p2, const Color& borderColor, bool isFilled, const Color& fillColor)
+{
+	Command command = Command();
+	command.type = TRIANGLE;
+	command.p0 = p0; command.p1 = p1; command.p2 = p2;
+	command.filled = isFilled;
+	command.color = borderColor;
+	command.fill_color = fillColor;
+
+	// Same vertices as the raster ((int) of each coordinate), one pixel of margin
+	int x0 = std::min(std::min((int)p0.x, (int)p1.x), (int)p2.x), x1 = std::max(std::max((int)p0.x, (int)p1.x), (int)p2.x);
+	int y0 = std::min(std::min((int)p0.y, (int)p1.y), (int)p2.y), y1 = std::max(std::max((int)p0.y, (int)p1.y), (int)p2.y);
+	Add(command, x0 - 1, y0 - 1, x1 + 2, y1 + 2);
+}
+
+void DrawList::DrawImage(const Image& image, int x, int y)
+{
+	DrawImage(image, x, y, 0, 0, image.width, image.height);
+}
+
+void DrawList::DrawImage(const Image& image, int x, int y, int src_x, int src_y, int src_width, int src_height)
+{
+	Command command = Command();
+	command.type = IMAGE;
+	command.x = x; command.y = y; command.w = src_width; command.h = src_height;
+	command.src_x = src_x; command.src_y = src_y;
+	command.image = &image;
+
+	// Destination of the part of the source area inside the image
+	if (src_x < 0) { x -= src_x; src_width += src_x; src_x = 0; }
+	if (src_y < 0) { y -= src_y; src_height += src_y; src_y = 0; }
+	src_width = std::min(src_width, (int)image.width - src_x);
+	src_height = std::min(src_height, (int)image.height - src_y);
+	Add(command, x, y, x + std::max(src_width, 0), y + std::max(src_height, 0));
+}
+
+void DrawList::Draw(const Command& command, Image& target, const Image::ClipRect& clip)
+{
+	switch (command.type)
+	{
+		case LINE:
+			target.RasterLineDDA(command.x, command.y, command.w, command.h, command.color, clip);
+			break;
+		case RECT:
+			target.RasterRect(command.x, command.y, command.w, command.h, command.color, command.border_width, command.filled, command.fill_color, clip);
+			break;
+		case TRIANGLE:
+			target.RasterTriangle(command.p0, command.p1, command.p2, command.color, command.filled, command.fill_color, clip);
+			break;
+		case IMAGE:
+			target.RasterImage(*command.image, command.x, command.y, command.src_x, command.src_y, command.w, command.h, clip);
+			break;
+	}
+}
+
+void DrawList::Bin(int width, int height)
+{
+	PROFILE_SCOPE("DrawList::Bin");
+
+	const int tiles_x = (width + tile_size - 1) / tile_size;
+	const int tiles_y = (height + tile_size - 1) / tile_size;
+	const Image::ClipRect target = { 0, 0, width, height };
+
+	// Count the commands of every tile (in bin_start[tile + 1]), then the offsets
+	bin_start.assign(tiles_x * tiles_y + 1, 0);
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		for (size_t i = 0; i < commands.size(); ++i)
+		{
+			Image::ClipRect area = intersect(commands[i].bounds, target);
+			if (isEmpty(area))
+				continue;
+
+			for (int ty = area.y0 / tile_size; ty <= (area.y1 - 1) / tile_size; ++ty)
+				for (int tx = area.x0 / tile_size; tx <= (area.x1 - 1) / tile_size; ++tx)
+				{
+					int tile = ty * tiles_x + tx;
+					if (pass == 0)
+						bin_start[tile + 1]++;
+					else
+						bin_commands[bin_start[tile]++] = (int)i;
+				}
+		}
+
+		// The second pass uses bin_start[tile] as the write position of the tile
+		if (pass == 0)
+		{
+			for (int t = 0; t < tiles_x * tiles_y; ++t)
+				bin_start[t + 1] += bin_start[t];
+			bin_commands.resize(bin_start.back());
+		}
+	}
+
+	// Back to the starts: the write position of every tile ended at the start of the next one
+	for (int t = tiles_x * tiles_y; t > 0; --t)
+		bin_start[t] = bin_start[t - 1];
+	bin_start[0] = 0;
+
+	binned_width = width;
+	binned_height = height;
+	bins_valid = true;
+}
+
+void DrawList::Execute(Image& target, bool parallel)
+{
+	PROFILE_SCOPE("DrawList::Execute");
+
+	if (target.width == 0 || target.height == 0 || commands.empty())
+		return;
+
+#ifdef CG_RASTER_STATS
+	for (size_t i = 0; i < commands.size(); ++i)
+	{
+		static const RasterStats::Primitive primitives[] = { RasterStats::LINE, RasterStats::RECT, RasterStats::TRIANGLE, RasterStats::IMAGE };
+		RasterStats::CountPrimitive(primitives[commands[i].type]);
+	}
+#endif
+
+	if (!parallel)
+	{
+		const Image::ClipRect bounds = target.GetBounds();
+		for (size_t i = 0; i < commands.size(); ++i)
+		{
+			if (isEmpty(intersect(commands[i].bounds, bounds)))
+				continue;
+			Draw(commands[i], target, intersect(commands[i].clip, bounds));
+		}
+		return;
+	}
+
+	if (!bins_valid || binned_width != (int)target.width || binned_height != (int)target.height)
+		Bin((int)target.width, (int)target.height);
+
+	const int tiles_x = (binned_width + tile_size - 1) / tile_size;
+	const int num_tiles = (int)bin_start.size() - 1;
+	TaskScheduler::Get()->ParallelFor(0, num_tiles, 1, [&](int first_tile, int last_tile) {
+		PROFILE_SCOPE("DrawList::Tiles");
+		for (int tile = first_tile; tile < last_tile; ++tile)
+		{
+			int x0 = (tile % tiles_x) * tile_size, y0 = (tile / tiles_x) * tile_size;
+			Image::ClipRect area = { x0, y0, std::min(x0 + tile_size, binned_width), std::min(y0 + tile_size, binned_height) };
+			for (int k = bin_start[tile]; k < bin_start[tile + 1]; ++k)
+			{
+				const Command& command = commands[bin_commands[k]];
+				Draw(command, target, intersect(command.clip, area));
+			}
+		}
+	});
+}
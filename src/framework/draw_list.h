@@ -0,0 +1,74 @@
+/*
+	+ DrawList records the drawing primitives of Image (lines, rects, triangles, images) and draws them later in one pass:
+	  in order on the calling thread, or split in tiles drawn in parallel by the TaskScheduler.
+	+ Every tile draws the commands that touch it in recording order, clipped to the tile, so the result is the same
+	  as drawing them directly on the image.
+	+ A list can be executed again (replayed) until it is cleared. The commands are binned by tile once and the bins
+	  are kept while the list and the size of the target do not change.
+	+ Commands entirely outside the target are skipped (their pixels are not counted as rejected by RasterStats).
+	+ State: SetClipRect limits the commands recorded after it to an area of the target.
+	+ Images are referenced, not copied: they must stay alive and unchanged while the list is used.
+*/
+
+#pragma once
+
+#include "image.h"
+#include <vector>
+
+class DrawList
+{
+public:
+	static const int DEFAULT_TILE_SIZE = 64;
+
+	DrawList(int tile_size = DEFAULT_TILE_SIZE);
+
+	// Removes every command (keeps the memory) and the clip area
+	void Clear();
+	size_t GetNumCommands() const { return commands.size(); }
+
+	// Commands recorded from now on only draw inside this area (in pixels of the target)
+	void SetClipRect(int x, int y, int w, int h);
+	void ResetClipRect();
+
+	// Same parameters and result as the functions of Image
+	void DrawLineDDA(int x0, int y0, int x1, int y1, const Color& c);
+	void DrawRect(int x, int y, int w, int h, const Color& borderColor, int borderWidth, bool isFilled, const Color& fillColor);
+	void DrawTriangle(const Vector2& p0, const Vector2& p1, const Vector2& p2, const Color& borderColor, bool isFilled, const Color& fillColor);
+	void DrawImage(const Image& image, int x, int y);
+	void DrawImage(const Image& image, int x, int y, int src_x, int src_y, int src_width, int src_height);
+
+	// Draws every command on target: by tiles in parallel, or in order on this thread. With a single core the serial
+	// path is faster (no binning, triangles are not split by tiles)
+	void Execute(Image& target, bool parallel = true);
+
+private:
+	enum CommandType { LINE, RECT, TRIANGLE, IMAGE };
+
+	struct Command
+	{
+		CommandType type;
+		Image::ClipRect clip;       // State when it was recorded
+		Image::ClipRect bounds;     // Pixels it can write (clip included), used to bin it
+		int x, y, w, h;             // LINE: x0, y0, x1, y1. RECT/IMAGE: position and size (IMAGE: of the source area)
+		int src_x, src_y;           // IMAGE
+		int border_width;           // RECT
+		bool filled;                // RECT/TRIANGLE
+		Vector2 p0, p1, p2;         // TRIANGLE
+		Color color, fill_color;
+		const Image* image;         // IMAGE
+	};
+
+	int tile_size;
+	Image::ClipRect clip;
+	std::vector<Command> commands;
+
+	// Commands of every tile (counting sort by tile, recording order inside a tile)
+	std::vector<int> bin_start;
+	std::vector<int> bin_commands;
+	int binned_width = -1, binned_height = -1;
+	bool bins_valid = false;
+
+	void Add(Command& command, int x0, int y0, int x1, int y1);
+	void Bin(int width, int height);
+	static void Draw(const Command& command, Image& target, const Image::ClipRect& clip);
+};
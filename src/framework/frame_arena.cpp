@@ -0,0 +1,72 @@
+#include "frame_arena.h"
+#include <algorithm>
+#include <stdint.h>
+
+const size_t FrameArena::MIN_BLOCK_SIZE;
+
+FrameArena* FrameArena::Get()
+{
+	static thread_local FrameArena arena;
+	return &arena;
+}
+
+void* FrameArena::Allocate(size_t size, size_t alignment)
+{
+	// Find the first block (from the current one) with room, or add one
+	for (;; ++block, offset = 0)
+	{
+		if (block == blocks.size())
+		{
+			Block new_block;
+			new_block.size = std::max(std::max(MIN_BLOCK_SIZE, size + alignment), blocks.empty() ? 0 : blocks.back().size * 2);
+			new_block.data.reset(new unsigned char[new_block.size]);
+			blocks.push_back(std::move(new_block));
+		}
+
+		Block& current = blocks[block];
+		uintptr_t base = (uintptr_t)current.data.get();
+		size_t start = (size_t)(((base + offset + alignment - 1) & ~(uintptr_t)(alignment - 1)) - base);
+		if (start + size <= current.size)
+		{
+			offset = start + size;
+			peak = std::max(peak, GetUsed());
+			return current.data.get() + start;
+		}
+	}
+}
+
+void FrameArena::Reset()
+{
+	if (blocks.size() > 1)
+	{
+		// The frame did not fit in the first block: replace them all by one block as big as all of them
+		size_t total = 0;
+		for (size_t i = 0; i < blocks.size(); ++i)
+			total += blocks[i].size;
+		blocks.clear();
+
+		Block merged;
+		merged.size = total;
+		merged.data.reset(new unsigned char[total]);
+		blocks.push_back(std::move(merged));
+	}
+	block = 0;
+	offset = 0;
+	peak = 0;
+}
+
+size_t FrameArena::GetUsed() const
+{
+	size_t used = offset;
+	for (size_t i = 0; i < block && i < blocks.size(); ++i)
+		used += blocks[i].size;
+	return used;
+}
+
+size_t FrameArena::GetCapacity() const
+{
+	size_t capacity = 0;
+	for (size_t i = 0; i < blocks.size(); ++i)
+		capacity += blocks[i].size;
+	return capacity;
+}
@@ -0,0 +1,65 @@
+/*
+	+ Linear allocator for scratch memory: allocating only moves a pointer and nothing is freed individually.
+	+ Every thread has its own arena (Get). Code that needs temporary memory opens a FrameArena::Scope, which gives
+	  back everything allocated inside it; the main loop also resets the arena of the main thread after every frame.
+	+ Blocks are kept between frames, so once the arena is big enough for a frame it never allocates again.
+*/
+
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <cstddef>
+
+class FrameArena
+{
+public:
+	static FrameArena* Get();   // Arena of the calling thread
+
+	// Uninitialized memory, valid until the enclosing Scope ends or the arena is reset
+	void* Allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+
+	// Uninitialized array of count T (T must not need a destructor)
+	template <typename T>
+	T* Allocate(size_t count) { return static_cast<T*>(Allocate(count * sizeof(T), alignof(T))); }
+
+	// Frees everything. If the frame needed more than one block they are merged, so the next frame fits in one.
+	void Reset();
+
+	size_t GetUsed() const;             // Bytes allocated since the last reset
+	size_t GetCapacity() const;         // Bytes of every block
+	size_t GetPeak() const { return peak; }    // Most bytes used since the last reset
+
+	// Rewinds the arena of the calling thread to where it was when the scope was created
+	class Scope
+	{
+	public:
+		Scope() : arena(FrameArena::Get()), block(arena->block), offset(arena->offset) {}
+		~Scope() { arena->block = block; arena->offset = offset; }
+
+	private:
+		FrameArena* arena;
+		size_t block, offset;
+
+		Scope(const Scope&);
+		Scope& operator = (const Scope&);
+	};
+
+private:
+	static const size_t MIN_BLOCK_SIZE = 64 * 1024;
+
+	struct Block
+	{
+		std::unique_ptr<unsigned char[]> data;
+		size_t size;
+	};
+
+	std::vector<Block> blocks;
+	size_t block = 0;       // Block being filled
+	size_t offset = 0;      // Bytes used of that block
+	size_t peak = 0;
+
+	FrameArena() {}
+	FrameArena(const FrameArena&);
+	FrameArena& operator = (const FrameArena&);
+};
@@ -2,12 +2,21 @@
 #include <iostream>
 #include <fstream>
 #include <algorithm>
+#include <cctype>
+#ifndef CG_HEADLESS
 #include "GL/glew.h"
+#endif
 #include "../extra/picopng.h"
+#include "../extra/pngencoder.h"
 #include "image.h"
 #include "utils.h"
 #include "camera.h"
+#include "frame_arena.h"
 #include "mesh.h"
+#include "profiler.h"
+#include "task_scheduler.h"
+
+const unsigned int Image::PARALLEL_PIXELS;
 
 Image::Image() {
 
@@ -38,6 +47,18 @@ Image::Image(const Image& c)
 	}
 }
 
+// Move constructor
+Image::Image(Image&& c)
+{
+	width = c.width;
+	height = c.height;
+	bytes_per_pixel = c.bytes_per_pixel;
+	pixels = c.pixels;
+
+	c.width = c.height = 0;
+	c.pixels = NULL;
+}
+
 // Assign operator
 Image& Image::operator = (const Image& c)
 {
@@ -57,18 +78,37 @@ Image& Image::operator = (const Image& c)
 	return *this;
 }
 
+// Move assign operator
+Image& Image::operator = (Image&& c)
+{
+	if (this == &c) return *this;
+	if (pixels) delete[] pixels;
+
+	width = c.width;
+	height = c.height;
+	bytes_per_pixel = c.bytes_per_pixel;
+	pixels = c.pixels;
+
+	c.width = c.height = 0;
+	c.pixels = NULL;
+	return *this;
+}
+
 Image::~Image()
 {
 	if (pixels)
 		delete[] pixels;
 }
 
+#ifndef CG_HEADLESS
 void Image::Render()
 {
+	PROFILE_SCOPE("Image::Render");
 
 	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 	glDrawPixels(width, height, bytes_per_pixel == 3 ? GL_RGB : GL_RGBA, GL_UNSIGNED_BYTE, pixels);
 }
+#endif
 
 // Change image size (the old one will remain in the top-left corner)
 void Image::Resize(unsigned int width, unsigned int height)
@@ -91,15 +131,25 @@ void Image::Resize(unsigned int width, unsigned int height)
 // Change image size and scale the content
 void Image::Scale(unsigned int width, unsigned int height)
 {
+	PROFILE_SCOPE("Image::Scale");
 
 	Color* new_pixels = new Color[width * height];
 
+	// Source column of every destination column, the rows are split between threads
+	FrameArena::Scope scratch;
+	unsigned int* src_x = FrameArena::Get()->Allocate<unsigned int>(width);
 	for (unsigned int x = 0; x < width; ++x)
-		for (unsigned int y = 0; y < height; ++y)
-			new_pixels[y * width + x] = GetPixel(
-				(unsigned int)(this->width * (x / (float)width)),
-				(unsigned int)(this->height * (y / (float)height))
-			);
+		src_x[x] = (unsigned int)(this->width * (x / (float)width));
+
+	TaskScheduler::Get()->ParallelFor(0, height, GetRowsPerTask(width), [&](int first_row, int last_row) {
+		for (unsigned int y = first_row; y < (unsigned int)last_row; ++y)
+		{
+			const Color* src = pixels + (unsigned int)(this->height * (y / (float)height)) * this->width;
+			Color* dst = new_pixels + y * width;
+			for (unsigned int x = 0; x < width; ++x)
+				dst[x] = src[src_x[x]];
+		}
+	});
 
 	delete[] pixels;
 	this->width = width;
@@ -107,6 +157,13 @@ void Image::Scale(unsigned int width, unsigned int height)
 	pixels = new_pixels;
 }
 
+void Image::Fill(const Color& c)
+{
+	TaskScheduler::Get()->ParallelFor(0, height, GetRowsPerTask(width), [this, &c](int first_row, int last_row) {
+		std::fill(pixels + first_row * width, pixels + last_row * width, c);
+	});
+}
+
 Image Image::GetArea(unsigned int start_x, unsigned int start_y, unsigned int width, unsigned int height)
 {
 
@@ -122,23 +179,35 @@ Image Image::GetArea(unsigned int start_x, unsigned int start_y, unsigned int wi
 
 void Image::FlipY()
 {
+	PROFILE_SCOPE("Image::FlipY");
 
 	int row_size = bytes_per_pixel * width;
-	Uint8* temp_row = new Uint8[row_size];
+	int half_height = height / 2;
+	FrameArena::Scope scratch;
+	unsigned char* temp_row = FrameArena::Get()->Allocate<unsigned char>(row_size);
 #pragma omp simd
-	for (int y = 0; y < height * 0.5; y += 1)
+	for (int y = 0; y < half_height; y += 1)
 	{
-		Uint8* pos = (Uint8*)pixels + y * row_size;
+		unsigned char* pos = (unsigned char*)pixels + y * row_size;
 		memcpy(temp_row, pos, row_size);
-		Uint8* pos2 = (Uint8*)pixels + (height - y - 1) * row_size;
+		unsigned char* pos2 = (unsigned char*)pixels + (height - y - 1) * row_size;
 		memcpy(pos, pos2, row_size);
 		memcpy(pos2, temp_row, row_size);
 	}
-	delete[] temp_row;
+}
+
+bool Image::Load(const char* filename, bool flip_y)
+{
+	size_t len = strlen(filename);
+	if (len >= 4 && tolower(filename[len - 4]) == '.' && tolower(filename[len - 3]) == 't' &&
+		tolower(filename[len - 2]) == 'g' && tolower(filename[len - 1]) == 'a')
+		return LoadTGA(filename, flip_y);
+	return LoadPNG(filename, flip_y);
 }
 
 bool Image::LoadPNG(const char* filename, bool flip_y)
 {
+	PROFILE_SCOPE("Image::LoadPNG");
 
 	std::string sfullPath = absResPath(filename);
 	std::ifstream file(sfullPath, std::ios::in | std::ios::binary | std::ios::ate);
@@ -206,101 +275,177 @@ bool Image::LoadPNG(const char* filename, bool flip_y)
 	return true;
 }
 
-// Loads an image from a TGA file
+// TGA files are read and written through a buffer of this size instead of a copy of the whole image
+static const size_t TGA_CHUNK_SIZE = 64 * 1024;
+
+namespace {
+
+// Buffered reader used to decode TGA files in chunks
+class TGAReader
+{
+	FILE* file;
+	unsigned char buffer[TGA_CHUNK_SIZE];
+	size_t pos = 0;
+	size_t size = 0;
+
+public:
+	TGAReader(FILE* file) : file(file) {}
+
+	// Makes sure that at least n bytes are available, returns false at the end of the file
+	bool Fill(size_t n)
+	{
+		if (size - pos >= n) return true;
+		memmove(buffer, buffer + pos, size - pos);
+		size -= pos;
+		pos = 0;
+		size += fread(buffer + size, 1, TGA_CHUNK_SIZE - size, file);
+		return size >= n;
+	}
+
+	size_t Available() const { return size - pos; }
+	const unsigned char* Data() const { return buffer + pos; }
+	void Skip(size_t n) { pos += n; }
+};
+
+}
+
+// Loads an image from a TGA file (uncompressed or RLE, 24 or 32 bits)
 bool Image::LoadTGA(const char* filename, bool flip_y)
 {
+	PROFILE_SCOPE("Image::LoadTGA");
 
-	unsigned char TGAheader[12] = { 0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
-	unsigned char TGAcompare[12];
-	unsigned char header[6];
-	unsigned int imageSize;
-	unsigned int bytesPerPixel;
+	unsigned char header[18];
 
 	std::string sfullPath = absResPath(filename);
 
 	FILE* file = fopen(sfullPath.c_str(), "rb");
-	if (file == NULL || fread(TGAcompare, 1, sizeof(TGAcompare), file) != sizeof(TGAcompare) ||
-		memcmp(TGAheader, TGAcompare, sizeof(TGAheader)) != 0 ||
-		fread(header, 1, sizeof(header), file) != sizeof(header))
+	if (file == NULL || fread(header, 1, sizeof(header), file) != sizeof(header))
 	{
 		std::cerr << "--- File not found: " << sfullPath.c_str() << std::endl;
-		if (file == NULL)
-			return NULL;
-		else
-		{
+		if (file != NULL)
 			fclose(file);
-			return NULL;
-		}
+		return false;
 	}
 
-	TGAInfo* tgainfo = new TGAInfo;
+	unsigned int type = header[2];
+	unsigned int tga_width = header[13] * 256 + header[12];
+	unsigned int tga_height = header[15] * 256 + header[14];
+	unsigned int bytesPerPixel = header[16] / 8;
+	bool top_origin = (header[17] & 0x20) != 0;
 
-	tgainfo->width = header[1] * 256 + header[0];
-	tgainfo->height = header[3] * 256 + header[2];
-
-	if (tgainfo->width <= 0 || tgainfo->height <= 0 || (header[4] != 24 && header[4] != 32))
+	// Only true color images without color map (type 2) or with RLE compression (type 10)
+	if ((type != 2 && type != 10) || header[1] != 0 || tga_width == 0 || tga_height == 0 ||
+		(header[16] != 24 && header[16] != 32) || fseek(file, header[0], SEEK_CUR) != 0)
 	{
 		std::cerr << "--- Failed to load file: " << sfullPath.c_str() << std::endl;
 		fclose(file);
-		delete tgainfo;
-		return NULL;
+		return false;
 	}
 
-	tgainfo->bpp = header[4];
-	bytesPerPixel = tgainfo->bpp / 8;
-	imageSize = tgainfo->width * tgainfo->height * bytesPerPixel;
+	Color* new_pixels = new Color[tga_width * tga_height];
+
+	// File rows are stored bottom-up unless the origin is in the top-left corner
+	unsigned int x = 0, row = 0;
+	Color* dst = new_pixels + (top_origin ? 0 : tga_height - 1) * tga_width;
+	auto advance = [&]() {
+		if (++x < tga_width) return;
+		x = 0;
+		if (++row < tga_height)
+			dst = new_pixels + (top_origin ? row : tga_height - row - 1) * tga_width;
+	};
 
-	tgainfo->data = new unsigned char[imageSize];
+	TGAReader reader(file);
+	unsigned int remaining = tga_width * tga_height;
+	bool ok = true;
 
-	if (tgainfo->data == NULL || fread(tgainfo->data, 1, imageSize, file) != imageSize)
+	while (remaining > 0 && ok)
 	{
-		std::cerr << "--- Failed to load file: " << sfullPath.c_str() << std::endl;
+		// Uncompressed images are a single raw packet
+		unsigned int count = remaining;
+		bool run = false;
+		if (type == 10)
+		{
+			if (!reader.Fill(1)) { ok = false; break; }
+			unsigned char packet = *reader.Data();
+			reader.Skip(1);
+			run = (packet & 0x80) != 0;
+			count = std::min((unsigned int)(packet & 0x7F) + 1, remaining);
+		}
 
-		if (tgainfo->data != NULL)
-			delete[] tgainfo->data;
+		if (run)
+		{
+			if (!reader.Fill(bytesPerPixel)) { ok = false; break; }
+			const unsigned char* p = reader.Data();
+			Color c(p[2], p[1], p[0]);
+			reader.Skip(bytesPerPixel);
+			for (unsigned int i = 0; i < count; ++i)
+			{
+				dst[x] = c;
+				advance();
+			}
+		}
+		else
+		{
+			// Convert as many pixels as there are in the buffer
+			unsigned int left = count;
+			while (left > 0)
+			{
+				if (!reader.Fill(bytesPerPixel)) { ok = false; break; }
+				unsigned int n = std::min(left, (unsigned int)(reader.Available() / bytesPerPixel));
+				const unsigned char* p = reader.Data();
+				for (unsigned int i = 0; i < n; ++i, p += bytesPerPixel)
+				{
+					dst[x] = Color(p[2], p[1], p[0]);
+					advance();
+				}
+				reader.Skip(n * bytesPerPixel);
+				left -= n;
+			}
+		}
 
-		fclose(file);
-		delete tgainfo;
-		return false;
+		remaining -= count;
 	}
 
 	fclose(file);
 
+	if (!ok)
+	{
+		std::cerr << "--- Failed to load file: " << sfullPath.c_str() << std::endl;
+		delete[] new_pixels;
+		return false;
+	}
+
 	// Save info in image
 	if (pixels)
 		delete[] pixels;
 
-	width = tgainfo->width;
-	height = tgainfo->height;
-	pixels = new Color[width * height];
-
-	// Convert to float all pixels
-	for (unsigned int y = 0; y < height; ++y) {
-		for (unsigned int x = 0; x < width; ++x) {
-			unsigned int pos = y * width * bytesPerPixel + x * bytesPerPixel;
-			// Make sure we don't access out of memory
-			if ((pos < imageSize) && (pos + 1 < imageSize) && (pos + 2 < imageSize))
-				SetPixelUnsafe(x, height - y - 1, Color(tgainfo->data[pos + 2], tgainfo->data[pos + 1], tgainfo->data[pos]));
-		}
-	}
+	width = tga_width;
+	height = tga_height;
+	pixels = new_pixels;
 
 	// Flip pixels in Y
 	if (flip_y)
 		FlipY();
 
-	delete[] tgainfo->data;
-	delete tgainfo;
-
 	std::cout << "+++ File loaded: " << sfullPath.c_str() << std::endl;
 
 	return true;
 }
 
-// Saves the image to a TGA file
-bool Image::SaveTGA(const char* filename)
+// Saves the image to a TGA file (24 bits, optionally RLE compressed)
+bool Image::SaveTGA(const char* filename, bool rle, const ProgressCallback& progress)
 {
-	
-	unsigned char TGAheader[12] = { 0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+	if (!WriteTGA(filename, rle, progress))
+		return false;
+
+	std::cout << "+++ File saved: " << absResPath(filename).c_str() << std::endl;
+
+	return true;
+}
+
+bool Image::WriteTGA(const char* filename, bool rle, const ProgressCallback& progress)
+{
+	PROFILE_SCOPE("Image::WriteTGA");
 
 	std::string fullPath = absResPath(filename);
 	FILE* file = fopen(fullPath.c_str(), "wb");
@@ -310,38 +455,166 @@ bool Image::SaveTGA(const char* filename)
 		return false;
 	}
 
-	unsigned short header_short[3];
-	header_short[0] = width;
-	header_short[1] = height;
-	unsigned char* header = (unsigned char*)header_short;
-	header[4] = 24;
-	header[5] = 0;
+	unsigned char header[18] = { 0 };
+	header[2] = rle ? 10 : 2;
+	header[12] = width & 0xFF;
+	header[13] = (width >> 8) & 0xFF;
+	header[14] = height & 0xFF;
+	header[15] = (height >> 8) & 0xFF;
+	header[16] = 24;
+
+	bool ok = fwrite(header, 1, sizeof(header), file) == sizeof(header);
+
+	// Convert pixels to BGR bytes in chunks
+	unsigned char* buffer = new unsigned char[TGA_CHUNK_SIZE];
+	size_t used = 0;
+	auto flush = [&]() {
+		if (used && fwrite(buffer, 1, used, file) != used)
+			ok = false;
+		used = 0;
+	};
+	auto put_pixel = [&](const Color& c) {
+		buffer[used++] = c.b;
+		buffer[used++] = c.g;
+		buffer[used++] = c.r;
+	};
+
+	// Biggest packet: header + 128 pixels
+	const size_t max_packet = 1 + 128 * 3;
+
+	for (unsigned int y = 0; y < height && ok; ++y)
+	{
+		const Color* row = pixels + y * width;
 
-	fwrite(TGAheader, 1, sizeof(TGAheader), file);
-	fwrite(header, 1, 6, file);
+		if (progress && (y & 63) == 0)
+			progress(y / (float)height);
 
-	// Convert pixels to unsigned char
-	unsigned char* bytes = new unsigned char[width * height * 3];
-	for (unsigned int y = 0; y < height; ++y)
-		for (unsigned int x = 0; x < width; ++x)
+		if (!rle)
 		{
-			Color c = pixels[y * width + x];
-			unsigned int pos = (y * width + x) * 3;
-			bytes[pos + 2] = c.r;
-			bytes[pos + 1] = c.g;
-			bytes[pos] = c.b;
+			for (unsigned int x = 0; x < width; ++x)
+			{
+				if (used + 3 > TGA_CHUNK_SIZE) flush();
+				put_pixel(row[x]);
+			}
+			continue;
 		}
 
-	fwrite(bytes, 1, width * height * 3, file);
+		// RLE packets never cross scanlines
+		unsigned int x = 0;
+		while (x < width)
+		{
+			if (used + max_packet > TGA_CHUNK_SIZE) flush();
+
+			unsigned int run = 1;
+			while (x + run < width && run < 128 && memcmp(&row[x + run], &row[x], sizeof(Color)) == 0)
+				++run;
+
+			if (run > 1)
+			{
+				buffer[used++] = (unsigned char)(0x80 | (run - 1));
+				put_pixel(row[x]);
+				x += run;
+				continue;
+			}
+
+			// Raw packet until the next run starts
+			size_t packet = used++;
+			unsigned int n = 0;
+			while (x < width && n < 128)
+			{
+				if (x + 1 < width && memcmp(&row[x + 1], &row[x], sizeof(Color)) == 0) break;
+				put_pixel(row[x]);
+				++x;
+				++n;
+			}
+			buffer[packet] = (unsigned char)(n - 1);
+		}
+	}
+
+	flush();
 	fclose(file);
+	delete[] buffer;
+
+	if (!ok)
+	{
+		std::cerr << "--- Failed to save file: " << fullPath.c_str() << std::endl;
+		return false;
+	}
+
+	return true;
+}
 
-	delete[] bytes;
+// Saves the image to a PNG file
+bool Image::SavePNG(const char* filename, int level, bool flip_y, const ProgressCallback& progress, unsigned int num_threads)
+{
+	if (!WritePNG(filename, level, flip_y, progress, num_threads))
+		return false;
 
-	std::cout << "+++ File saved: " << fullPath.c_str() << std::endl;
+	std::cout << "+++ File saved: " << absResPath(filename).c_str() << std::endl;
 
 	return true;
 }
+
+bool Image::WritePNG(const char* filename, int level, bool flip_y, const ProgressCallback& progress, unsigned int num_threads)
+{
+	PROFILE_SCOPE("Image::WritePNG");
+
+	std::string fullPath = absResPath(filename);
+
+	std::vector<unsigned char> png;
+	if (!pixels || encodePNG(png, (const unsigned char*)pixels, width, height, 3, level, num_threads, flip_y, progress) != 0)
+	{
+		std::cerr << "--- Failed to encode file: " << fullPath.c_str() << std::endl;
+		return false;
+	}
+
+	FILE* file = fopen(fullPath.c_str(), "wb");
+	if (file == NULL)
+	{
+		std::cerr << "--- Failed to save file: " << fullPath.c_str() << std::endl;
+		return false;
+	}
+
+	bool ok = fwrite(&png[0], 1, png.size(), file) == png.size();
+	fclose(file);
+
+	if (!ok)
+	{
+		std::cerr << "--- Failed to save file: " << fullPath.c_str() << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+// floor() for the DDA steps (same result in the int range, without the libm call)
+static inline int floorToInt(float v)
+{
+	int i = (int)v;
+	return i - (v < (float)i);
+}
+
+#ifdef CG_RASTER_STATS
+// Positions of [a, b) whose clamp to [0, size) falls in [c0, c1): a pixel outside the image is counted as rejected
+// only by the clip area (tile) next to it
+static int64_t clampedCount(int a, int b, int c0, int c1, int size)
+{
+	int64_t count = std::max(std::min(b, c1) - std::max(a, c0), 0);
+	if (c0 <= 0) count += std::max(std::min(b, 0) - a, 0);
+	if (c1 >= size) count += std::max(b - std::max(a, size), 0);
+	return count;
+}
+#endif
+
 void Image::DrawLineDDA(int x0, int y0, int x1, int y1, const Color& c)
+{
+	PROFILE_SCOPE("Image::DrawLineDDA");
+	RASTER_COUNT_PRIMITIVE(LINE, 1);
+
+	RasterLineDDA(x0, y0, x1, y1, c, GetBounds());
+}
+
+void Image::RasterLineDDA(int x0, int y0, int x1, int y1, const Color& c, const ClipRect& clip)
 {
 	// DDA line rasterization (steps = max(|dx|,|dy|))
 	int dx = x1 - x0;
@@ -350,7 +623,7 @@ void Image::DrawLineDDA(int x0, int y0, int x1, int y1, const Color& c)
 
 	// Single point
 	if (d == 0) {
-		SetPixelSafeInt(x0, y0, c);
+		SetPixelClipped(x0, y0, c, clip);
 		return;
 	}
 
@@ -362,40 +635,64 @@ void Image::DrawLineDDA(int x0, int y0, int x1, int y1, const Color& c)
 
 	for (int i = 0; i <= d; ++i)
 	{
-		SetPixelSafeInt((int)floor(x), (int)floor(y), c);
+		SetPixelClipped(floorToInt(x), floorToInt(y), c, clip);
 		x += xInc;
 		y += yInc;
 	}
 }
 
 void Image::DrawRect(int x, int y, int w, int h, const Color& borderColor, int borderWidth, bool isFilled, const Color& fillColor)
+{
+	PROFILE_SCOPE("Image::DrawRect");
+	RASTER_COUNT_PRIMITIVE(RECT, 1);
+
+	RasterRect(x, y, w, h, borderColor, borderWidth, isFilled, fillColor, GetBounds());
+}
+
+void Image::RasterRect(int x, int y, int w, int h, const Color& borderColor, int borderWidth, bool isFilled, const Color& fillColor, const ClipRect& clip)
 {
 	// Normalize drag (w/h always positive)
 	if (w < 0) { x += w + 1; w = -w; }
 	if (h < 0) { y += h + 1; h = -h; }
 
-	// Fill
+	// Fill (rows clipped once)
 	if (isFilled)
-		for (int j = 0; j < h; ++j)
-			for (int i = 0; i < w; ++i)
-				SetPixelSafeInt(x + i, y + j, fillColor);
+	{
+		const int x0 = std::max(x, clip.x0), x1 = std::min(x + w, clip.x1);
+		const int y0 = std::max(y, clip.y0), y1 = std::min(y + h, clip.y1);
+		for (int j = y0; j < y1; ++j)
+		{
+			Color* row = pixels + j * width;
+			for (int i = x0; i < x1; ++i)
+				row[i] = fillColor;
+		}
+#ifdef CG_RASTER_STATS
+		int64_t written = (int64_t)std::max(x1 - x0, 0) * std::max(y1 - y0, 0);
+		RASTER_COUNT_PIXELS(written, clampedCount(x, x + w, clip.x0, clip.x1, width) * clampedCount(y, y + h, clip.y0, clip.y1, height) - written);
+#endif
+	}
 
 	// Border layers
 	borderWidth = std::max(1, borderWidth);
 	for (int bw = 0; bw < borderWidth; ++bw)
 	{
 		for (int i = bw; i < w - bw; ++i) {
-			SetPixelSafeInt(x + i, y + bw, borderColor);
-			SetPixelSafeInt(x + i, y + h - 1 - bw, borderColor);
+			SetPixelClipped(x + i, y + bw, borderColor, clip);
+			SetPixelClipped(x + i, y + h - 1 - bw, borderColor, clip);
 		}
 		for (int j = bw; j < h - bw; ++j) {
-			SetPixelSafeInt(x + bw, y + j, borderColor);
-			SetPixelSafeInt(x + w - 1 - bw, y + j, borderColor);
+			SetPixelClipped(x + bw, y + j, borderColor, clip);
+			SetPixelClipped(x + w - 1 - bw, y + j, borderColor, clip);
 		}
 	}
 }
 
 void Image::ScanLineDDA(int x0, int y0, int x1, int y1, std::vector<Cell>& table)
+{
+	ScanLineDDA(x0, y0, x1, y1, table.data(), 0, (int)table.size());
+}
+
+void Image::ScanLineDDA(int x0, int y0, int x1, int y1, Cell* table, int first_row, int rows)
 {
 	// DDA edge scan for AET: update minx/maxx per scanline
 	int dx = x1 - x0;
@@ -403,8 +700,8 @@ void Image::ScanLineDDA(int x0, int y0, int x1, int y1, std::vector<Cell>& table
 	int d = std::max(abs(dx), abs(dy));
 
 	if (d == 0) {
-		int iy = y0;
-		if (iy >= 0 && iy < (int)table.size()) {
+		int iy = y0 - first_row;
+		if (iy >= 0 && iy < rows) {
 			table[iy].minx = std::min(table[iy].minx, x0);
 			table[iy].maxx = std::max(table[iy].maxx, x0);
 		}
@@ -417,10 +714,10 @@ void Image::ScanLineDDA(int x0, int y0, int x1, int y1, std::vector<Cell>& table
 
 	for (int i = 0; i <= d; ++i)
 	{
-		int ix = (int)floor(x);
-		int iy = (int)floor(y);
+		int ix = floorToInt(x);
+		int iy = floorToInt(y) - first_row;
 
-		if (iy >= 0 && iy < (int)table.size()) {
+		if (iy >= 0 && iy < rows) {
 			table[iy].minx = std::min(table[iy].minx, ix);
 			table[iy].maxx = std::max(table[iy].maxx, ix);
 		}
@@ -433,53 +730,103 @@ void Image::ScanLineDDA(int x0, int y0, int x1, int y1, std::vector<Cell>& table
 void Image::DrawTriangle(const Vector2& p0, const Vector2& p1, const Vector2& p2,
 	const Color& borderColor, bool isFilled, const Color& fillColor)
 {
-	// AET triangle fill: build min/max table, then fill scanlines
-	std::vector<Cell> table(height);
-	for (unsigned int y = 0; y < height; ++y) {
-		table[y].minx = std::numeric_limits<int>::max();
-		table[y].maxx = std::numeric_limits<int>::min();
-	}
+	PROFILE_SCOPE("Image::DrawTriangle");
+	RASTER_COUNT_PRIMITIVE(TRIANGLE, 1);
 
-	ScanLineDDA((int)p0.x, (int)p0.y, (int)p1.x, (int)p1.y, table);
-	ScanLineDDA((int)p1.x, (int)p1.y, (int)p2.x, (int)p2.y, table);
-	ScanLineDDA((int)p2.x, (int)p2.y, (int)p0.x, (int)p0.y, table);
+	RasterTriangle(p0, p1, p2, borderColor, isFilled, fillColor, GetBounds());
+}
 
+void Image::RasterTriangle(const Vector2& p0, const Vector2& p1, const Vector2& p2,
+	const Color& borderColor, bool isFilled, const Color& fillColor, const ClipRect& clip)
+{
+	// AET triangle fill: min/max table of the rows of the triangle only (frame scratch), then one span per row
 	if (isFilled)
 	{
-		for (int y = 0; y < (int)table.size(); ++y)
+		// One row of margin: the DDA can end a row past an endpoint (float steps)
+		const int y_min = std::max(std::min(std::min((int)p0.y, (int)p1.y), (int)p2.y) - 1, clip.y0);
+		const int y_max = std::min(std::max(std::max((int)p0.y, (int)p1.y), (int)p2.y) + 1, clip.y1 - 1);
+		const int rows = y_max - y_min + 1;
+		if (rows > 0)
 		{
-			if (table[y].minx <= table[y].maxx)
-				for (int x = table[y].minx; x <= table[y].maxx; ++x)
-					SetPixelSafeInt(x, y, fillColor);
+			FrameArena::Scope scratch;
+			Cell* table = FrameArena::Get()->Allocate<Cell>(rows);
+			for (int r = 0; r < rows; ++r) {
+				table[r].minx = std::numeric_limits<int>::max();
+				table[r].maxx = std::numeric_limits<int>::min();
+			}
+
+			ScanLineDDA((int)p0.x, (int)p0.y, (int)p1.x, (int)p1.y, table, y_min, rows);
+			ScanLineDDA((int)p1.x, (int)p1.y, (int)p2.x, (int)p2.y, table, y_min, rows);
+			ScanLineDDA((int)p2.x, (int)p2.y, (int)p0.x, (int)p0.y, table, y_min, rows);
+
+			for (int r = 0; r < rows; ++r)
+			{
+				if (table[r].minx > table[r].maxx)
+					continue;
+
+				// Span clipped to the clip area
+				int x0 = std::max(table[r].minx, clip.x0);
+				int x1 = std::min(table[r].maxx, clip.x1 - 1);
+#ifdef CG_RASTER_STATS
+				int span = std::max(x1 - x0 + 1, 0);
+				RASTER_COUNT_PIXELS(span, clampedCount(table[r].minx, table[r].maxx + 1, clip.x0, clip.x1, width) - span);
+#endif
+				Color* row = pixels + (y_min + r) * width;
+				for (int x = x0; x <= x1; ++x)
+					row[x] = fillColor;
+			}
 		}
 	}
 
 	// Border
-	DrawLineDDA((int)p0.x, (int)p0.y, (int)p1.x, (int)p1.y, borderColor);
-	DrawLineDDA((int)p1.x, (int)p1.y, (int)p2.x, (int)p2.y, borderColor);
-	DrawLineDDA((int)p2.x, (int)p2.y, (int)p0.x, (int)p0.y, borderColor);
+	RasterLineDDA((int)p0.x, (int)p0.y, (int)p1.x, (int)p1.y, borderColor, clip);
+	RasterLineDDA((int)p1.x, (int)p1.y, (int)p2.x, (int)p2.y, borderColor, clip);
+	RasterLineDDA((int)p2.x, (int)p2.y, (int)p0.x, (int)p0.y, borderColor, clip);
 }
 
 void Image::DrawImage(const Image& image, int x, int y)
 {
-	// Simple blit using safe writes
-	for (int iy = 0; iy < (int)image.height; ++iy)
-		for (int ix = 0; ix < (int)image.width; ++ix)
-			SetPixelSafeInt(x + ix, y + iy, image.GetPixel(ix, iy));
+	DrawImage(image, x, y, 0, 0, image.width, image.height);
 }
 
-#ifndef IGNORE_LAMBDAS
+void Image::DrawImage(const Image& image, int x, int y, int src_x, int src_y, int src_width, int src_height)
+{
+	PROFILE_SCOPE("Image::DrawImage");
+	RASTER_COUNT_PRIMITIVE(IMAGE, 1);
 
-// You can apply and algorithm for two images and store the result in the first one
-// ForEachPixel( img, img2, [](Color a, Color b) { return a + b; } );
-template <typename F>
-void ForEachPixel(Image& img, const Image& img2, F f) {
-	for (unsigned int pos = 0; pos < img.width * img.height; ++pos)
-		img.pixels[pos] = f(img.pixels[pos], img2.pixels[pos]);
+	RasterImage(image, x, y, src_x, src_y, src_width, src_height, GetBounds());
 }
 
+void Image::RasterImage(const Image& image, int x, int y, int src_x, int src_y, int src_width, int src_height, const ClipRect& clip)
+{
+	// Clip the source area against the source image
+	if (src_x < 0) { x -= src_x; src_width += src_x; src_x = 0; }
+	if (src_y < 0) { y -= src_y; src_height += src_y; src_y = 0; }
+	src_width = std::min(src_width, (int)image.width - src_x);
+	src_height = std::min(src_height, (int)image.height - src_y);
+#ifdef CG_RASTER_STATS
+	const int64_t area = src_width > 0 && src_height > 0 ?
+		clampedCount(x, x + src_width, clip.x0, clip.x1, width) * clampedCount(y, y + src_height, clip.y0, clip.y1, height) : 0;
 #endif
 
+	// Clip against the clip area of this image
+	if (x < clip.x0) { src_x += clip.x0 - x; src_width -= clip.x0 - x; x = clip.x0; }
+	if (y < clip.y0) { src_y += clip.y0 - y; src_height -= clip.y0 - y; y = clip.y0; }
+	src_width = std::min(src_width, clip.x1 - x);
+	src_height = std::min(src_height, clip.y1 - y);
+
+	if (src_width <= 0 || src_height <= 0)
+	{
+		RASTER_COUNT_PIXELS(0, area);
+		return;
+	}
+	RASTER_COUNT_PIXELS((int64_t)src_width * src_height, area - (int64_t)src_width * src_height);
+
+	// Copy whole rows
+	for (int iy = 0; iy < src_height; ++iy)
+		memcpy(pixels + (y + iy) * width + x, image.pixels + (src_y + iy) * image.width + src_x, src_width * sizeof(Color));
+}
+
 FloatImage::FloatImage(unsigned int width, unsigned int height)
 {
 	this->width = width;
@@ -517,6 +864,13 @@ FloatImage& FloatImage::operator = (const FloatImage& c)
 	return *this;
 }
 
+void FloatImage::Fill(const float& v)
+{
+	TaskScheduler::Get()->ParallelFor(0, height, Image::GetRowsPerTask(width), [this, &v](int first_row, int last_row) {
+		std::fill(pixels + first_row * width, pixels + last_row * width, v);
+	});
+}
+
 FloatImage::~FloatImage()
 {
 	if (pixels)
@@ -9,8 +9,13 @@
 #include <stdio.h>
 #include <iostream>
 #include "framework.h"
+#include "raster_stats.h"
+#include "task_scheduler.h"
 #include <vector>
 #include <climits>
+#include <cassert>
+#include <functional>
+#include <algorithm>
 
 //remove unsafe warnings
 #ifndef _CRT_SECURE_NO_WARNINGS
@@ -25,14 +30,6 @@ class Camera;
 // A matrix of pixels
 class Image
 {
-	// A general struct to store all the information about a TGA file
-	typedef struct sTGAInfo {
-		unsigned int width;
-		unsigned int height;
-		unsigned int bpp; // Bits per pixel
-		unsigned char* data; // Bytes with the pixel information
-	} TGAInfo;
-
 	// LAB1: AET cell (min/max X per scanline)
 	typedef struct Cell
 	{
@@ -48,10 +45,21 @@ public:
 	// Channels sent to OpenGL in Render() (RGB=3, RGBA=4)
 	unsigned int bytes_per_pixel = 3;
 
+	// Receives the fraction of work done (0..1) while saving
+	typedef std::function<void(float progress)> ProgressCallback;
+
+	// Area of the image a primitive can write: [x0, x1) x [y0, y1)
+	struct ClipRect
+	{
+		int x0, y0, x1, y1;
+	};
+	ClipRect GetBounds() const { ClipRect bounds = { 0, 0, (int)width, (int)height }; return bounds; }
+
 	// Safe pixel write (avoids out-of-bounds) 
 	inline void SetPixelSafeInt(int x, int y, const Color& c)
 	{
-		if (x < 0 || y < 0 || x >= (int)width || y >= (int)height) return;
+		if (x < 0 || y < 0 || x >= (int)width || y >= (int)height) { RASTER_COUNT_PIXELS(0, 1); return; }
+		RASTER_COUNT_PIXELS(1, 0);
 		pixels[y * width + x] = c;
 	}
 
@@ -62,12 +70,16 @@ public:
 	Image();
 	Image(unsigned int width, unsigned int height);
 	Image(const Image& c);
+	Image(Image&& c); // Move constructor (takes the pixels of c)
 	Image& operator = (const Image& c); // Assign operator
+	Image& operator = (Image&& c); // Move assign operator
 
 	// Destructor
 	~Image();
 
-	void Render();
+#ifndef CG_HEADLESS
+	void Render(); // Draw with glDrawPixels (not available headless, save the image instead)
+#endif
 
 	// Get the pixel at position x,y
 	Color GetPixel(unsigned int x, unsigned int y) const { return pixels[y * width + x]; }
@@ -80,7 +92,7 @@ public:
 	}
 
 	// Set the pixel at position x,y with value C
-	void SetPixel(unsigned int x, unsigned int y, const Color& c) { if (x < 0 || x > width - 1) return; if (y < 0 || y > height - 1) return; pixels[y * width + x] = c; }
+	void SetPixel(unsigned int x, unsigned int y, const Color& c) { if (x > width - 1 || y > height - 1) { RASTER_COUNT_PIXELS(0, 1); return; } RASTER_COUNT_PIXELS(1, 0); pixels[y * width + x] = c; }
 	inline void SetPixelUnsafe(unsigned int x, unsigned int y, const Color& c) { pixels[y * width + x] = c; }
 
 	void Resize(unsigned int width, unsigned int height);
@@ -89,15 +101,25 @@ public:
 	void FlipY(); // Flip the image top-down
 
 	// Fill the image with the color C
-	void Fill(const Color& c) { for (unsigned int pos = 0; pos < width * height; ++pos) pixels[pos] = c; }
+	void Fill(const Color& c);
 
 	// Returns a new image with the area from (startx,starty) of size width,height
 	Image GetArea(unsigned int start_x, unsigned int start_y, unsigned int width, unsigned int height);
 
 	// Save or load images from the hard drive
+	// PNG or TGA by extension (any case), flip_y as in LoadPNG/LoadTGA: their defaults differ, so it must be given
+	bool Load(const char* filename, bool flip_y);
 	bool LoadPNG(const char* filename, bool flip_y = true);
-	bool LoadTGA(const char* filename, bool flip_y = false);
-	bool SaveTGA(const char* filename);
+	bool LoadTGA(const char* filename, bool flip_y = false); // Uncompressed or RLE
+	bool SaveTGA(const char* filename, bool rle = false, const ProgressCallback& progress = ProgressCallback());
+
+	// Compression level from 0 (fastest) to 9 (smallest), rows are compressed in parallel by num_threads threads
+	// (0 = one per core, 1 = only the calling thread)
+	bool SavePNG(const char* filename, int level = 6, bool flip_y = true, const ProgressCallback& progress = ProgressCallback(), unsigned int num_threads = 0);
+
+	// Same as SaveTGA/SavePNG without the "File saved" message (errors are still logged)
+	bool WriteTGA(const char* filename, bool rle = false, const ProgressCallback& progress = ProgressCallback());
+	bool WritePNG(const char* filename, int level = 6, bool flip_y = true, const ProgressCallback& progress = ProgressCallback(), unsigned int num_threads = 0);
 
 	// LAB1: Line raster (DDA)
 	void DrawLineDDA(int x0, int y0, int x1, int y1, const Color& c);
@@ -107,6 +129,7 @@ public:
 
 	// LAB1: Scan edge and update AET table (min/max X per Y) 
 	void ScanLineDDA(int x0, int y0, int x1, int y1, std::vector<Cell>& table);
+	void ScanLineDDA(int x0, int y0, int x1, int y1, Cell* table, int first_row, int rows); // table[0] is the row first_row
 
 	// LAB1: Triangle using AET + border
 	void DrawTriangle(const Vector2& p0, const Vector2& p1, const Vector2& p2, const Color& borderColor, bool isFilled, const Color& fillColor);
@@ -114,6 +137,41 @@ public:
 	// LAB1: Blit image into framebuffer 
 	void DrawImage(const Image& image, int x, int y);
 
+	// Blit only the area of size (src_width, src_height) starting at (src_x, src_y) of image
+	void DrawImage(const Image& image, int x, int y, int src_x, int src_y, int src_width, int src_height);
+
+private:
+	// The primitives limited to a clip area (inside the image). DrawList draws the tiles of a frame with them,
+	// so they count pixels but not primitives.
+	void RasterLineDDA(int x0, int y0, int x1, int y1, const Color& c, const ClipRect& clip);
+	void RasterRect(int x, int y, int w, int h, const Color& borderColor, int borderWidth, bool isFilled, const Color& fillColor, const ClipRect& clip);
+	void RasterTriangle(const Vector2& p0, const Vector2& p1, const Vector2& p2, const Color& borderColor, bool isFilled, const Color& fillColor, const ClipRect& clip);
+	void RasterImage(const Image& image, int x, int y, int src_x, int src_y, int src_width, int src_height, const ClipRect& clip);
+
+	inline void SetPixelClipped(int x, int y, const Color& c, const ClipRect& clip)
+	{
+		if (x < clip.x0 || y < clip.y0 || x >= clip.x1 || y >= clip.y1)
+		{
+			// Outside the image: rejected, once (by the clip area next to the pixel)
+			RASTER_COUNT_PIXELS(0, (x < 0 || y < 0 || x >= (int)width || y >= (int)height) && IsNextTo(x, y, clip));
+			return;
+		}
+		RASTER_COUNT_PIXELS(1, 0);
+		pixels[y * width + x] = c;
+	}
+
+	// The pixel clamped to the image is in the clip area
+	bool IsNextTo(int x, int y, const ClipRect& clip) const
+	{
+		x = std::min(std::max(x, 0), (int)width - 1);
+		y = std::min(std::max(y, 0), (int)height - 1);
+		return x >= clip.x0 && y >= clip.y0 && x < clip.x1 && y < clip.y1;
+	}
+
+	friend class DrawList;
+
+public:
+
 	// Used to easy code
 #ifndef IGNORE_LAMBDAS
 
@@ -127,9 +185,95 @@ public:
 			pixels[pos] = callback(pixels[pos]);
 		return *this;
 	}
+
+	// Same, with the rows split between the TaskScheduler threads: the callback is called from several threads at once
+	template <typename F>
+	Image& ForEachPixelParallel(F callback)
+	{
+		ForRows([this, &callback](unsigned int y) {
+			for (unsigned int pos = y * width; pos < (y + 1) * width; ++pos)
+				pixels[pos] = callback(pixels[pos]);
+		});
+		return *this;
+	}
+
+	// Calls callback(Color* row, unsigned int width, unsigned int y) once per row. The row is width * 3 bytes,
+	// so a loop over them is vectorized by the compiler:   [](Color* row, unsigned int w, unsigned int y) {
+	//     unsigned char* v = row->v; for (unsigned int i = 0; i < w * 3; ++i) v[i] = 255 - v[i]; }
+	template <typename F>
+	Image& ForEachRow(F callback)
+	{
+		for (unsigned int y = 0; y < height; ++y)
+			callback(pixels + y * width, width, y);
+		return *this;
+	}
+
+	template <typename F>
+	Image& ForEachRowParallel(F callback)
+	{
+		ForRows([this, &callback](unsigned int y) { callback(pixels + y * width, width, y); });
+		return *this;
+	}
 #endif
+
+	// Pixels per task of the operations split by rows between threads (smaller images are done on the calling thread)
+	static const unsigned int PARALLEL_PIXELS = 64 * 1024;
+	static int GetRowsPerTask(unsigned int width) { return (int)std::max(PARALLEL_PIXELS / std::max(width, 1u), 1u); }
+
+	// Calls row(y) for every row, split between the TaskScheduler threads
+	template <typename F>
+	void ForRows(const F& row) const
+	{
+		TaskScheduler::Get()->ParallelFor(0, height, GetRowsPerTask(width), [&row](int first_row, int last_row) {
+			for (int y = first_row; y < last_row; ++y)
+				row((unsigned int)y);
+		});
+	}
 };
 
+#ifndef IGNORE_LAMBDAS
+
+// You can apply and algorithm for two images of the same size and store the result in the first one
+// ForEachPixel( img, img2, [](Color a, Color b) { return a + b; } );
+template <typename F>
+void ForEachPixel(Image& img, const Image& img2, F f)
+{
+	assert(img.width == img2.width && img.height == img2.height);
+	for (unsigned int pos = 0; pos < img.width * img.height; ++pos)
+		img.pixels[pos] = f(img.pixels[pos], img2.pixels[pos]);
+}
+
+// Same, with the rows split between threads
+template <typename F>
+void ForEachPixelParallel(Image& img, const Image& img2, F f)
+{
+	assert(img.width == img2.width && img.height == img2.height);
+	img.ForRows([&img, &img2, &f](unsigned int y) {
+		for (unsigned int pos = y * img.width; pos < (y + 1) * img.width; ++pos)
+			img.pixels[pos] = f(img.pixels[pos], img2.pixels[pos]);
+	});
+}
+
+// Calls f(Color* row, const Color* row2, unsigned int width, unsigned int y) once per row
+template <typename F>
+void ForEachRow(Image& img, const Image& img2, F f)
+{
+	assert(img.width == img2.width && img.height == img2.height);
+	for (unsigned int y = 0; y < img.height; ++y)
+		f(img.pixels + y * img.width, img2.pixels + y * img.width, img.width, y);
+}
+
+template <typename F>
+void ForEachRowParallel(Image& img, const Image& img2, F f)
+{
+	assert(img.width == img2.width && img.height == img2.height);
+	img.ForRows([&img, &img2, &f](unsigned int y) {
+		f(img.pixels + y * img.width, img2.pixels + y * img.width, img.width, y);
+	});
+}
+
+#endif
+
 // Image storing one float per pixel instead of a 3 or 4 component Color
 class FloatImage
 {
@@ -148,7 +292,7 @@ public:
 	//destructor
 	~FloatImage();
 
-	void Fill(const float& v) { for (unsigned int pos = 0; pos < width * height; ++pos) pixels[pos] = v; }
+	void Fill(const float& v);
 
 	//get the pixel at position x,y
 	float GetPixel(unsigned int x, unsigned int y) const { return pixels[y * width + x]; }
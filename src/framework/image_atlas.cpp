@@ -0,0 +1,182 @@
+#include "image_atlas.h"
+#include "texture.h"
+#include <algorithm>
+#include <climits>
+
+ImageAtlas::ImageAtlas()
+{
+	texture = NULL;
+}
+
+ImageAtlas::~ImageAtlas()
+{
+	if (texture)
+	{
+		texture->Clear();
+		delete texture;
+	}
+}
+
+void ImageAtlas::Add(const std::string& name, std::shared_ptr<const Image> image)
+{
+	if (!image || !image->pixels)
+		return;
+	Item item = { name, image };
+	pending.push_back(item);
+}
+
+// Skyline bottom-left: the position where the rectangle top ends lowest (ties: the narrowest level)
+bool ImageAtlas::FindPosition(int width, int height, int atlas_width, int& best_node, int& best_x, int& best_y) const
+{
+	int best_top = INT_MAX, best_width = INT_MAX;
+	best_node = -1;
+
+	for (int i = 0; i < (int)skyline.size(); ++i)
+	{
+		int x = skyline[i].x;
+		if (x + width > atlas_width)
+			break;
+
+		// The rectangle rests on the highest level it covers
+		int y = 0, covered = 0;
+		for (int j = i; covered < width; ++j)
+		{
+			y = std::max(y, skyline[j].y);
+			covered += skyline[j].width;
+		}
+
+		if (y + height < best_top || (y + height == best_top && skyline[i].width < best_width))
+		{
+			best_top = y + height;
+			best_width = skyline[i].width;
+			best_node = i;
+			best_x = x;
+			best_y = y;
+		}
+	}
+	return best_node != -1;
+}
+
+void ImageAtlas::AddSkylineLevel(int node, int x, int y, int width, int height)
+{
+	SkylineNode level = { x, y + height, width };
+	skyline.insert(skyline.begin() + node, level);
+
+	// Cut the levels that are now below the new one
+	for (size_t i = node + 1; i < skyline.size(); )
+	{
+		int shrink = (skyline[i - 1].x + skyline[i - 1].width) - skyline[i].x;
+		if (shrink <= 0)
+			break;
+		skyline[i].x += shrink;
+		skyline[i].width -= shrink;
+		if (skyline[i].width > 0)
+			break;
+		skyline.erase(skyline.begin() + i);
+	}
+
+	// Merge neighbours at the same height
+	for (size_t i = 0; i + 1 < skyline.size(); )
+	{
+		if (skyline[i].y == skyline[i + 1].y)
+		{
+			skyline[i].width += skyline[i + 1].width;
+			skyline.erase(skyline.begin() + i + 1);
+		}
+		else
+			++i;
+	}
+}
+
+bool ImageAtlas::Build(unsigned int max_width, unsigned int padding)
+{
+	if (pending.empty())
+		return false;
+
+	// Tallest images first pack better
+	std::vector<int> order(pending.size());
+	size_t area = 0;
+	int widest = 0;
+	for (size_t i = 0; i < pending.size(); ++i)
+	{
+		order[i] = (int)i;
+		area += (pending[i].image->width + padding) * (pending[i].image->height + padding);
+		widest = std::max(widest, (int)(pending[i].image->width + padding));
+	}
+	std::sort(order.begin(), order.end(), [this](int a, int b) {
+		const Image& ia = *pending[a].image;
+		const Image& ib = *pending[b].image;
+		return ia.height != ib.height ? ia.height > ib.height : ia.width > ib.width;
+	});
+
+	// Roughly square atlas, as wide as needed for the widest image
+	int atlas_width = 1;
+	while (atlas_width * atlas_width < (int)area) atlas_width <<= 1;
+	atlas_width = std::max(std::min(atlas_width, (int)max_width), widest);
+
+	skyline.clear();
+	SkylineNode floor = { 0, 0, atlas_width };
+	skyline.push_back(floor);
+
+	std::vector<Region> packed(pending.size());
+	int atlas_height = 0;
+	for (size_t k = 0; k < order.size(); ++k)
+	{
+		const Image& src = *pending[order[k]].image;
+		int w = src.width + padding, h = src.height + padding;
+		int node, x, y;
+		if (!FindPosition(w, h, atlas_width, node, x, y))
+			return false;
+		AddSkylineLevel(node, x, y, w, h);
+
+		Region region = { x, y, (int)src.width, (int)src.height };
+		packed[order[k]] = region;
+		atlas_height = std::max(atlas_height, y + h);
+	}
+
+	// Compose the atlas
+	Image result(atlas_width, atlas_height);
+	regions.clear();
+	names.clear();
+	for (size_t i = 0; i < pending.size(); ++i)
+	{
+		result.DrawImage(*pending[i].image, packed[i].x, packed[i].y);
+		names[pending[i].name] = (int)regions.size();
+		regions.push_back(packed[i]);
+	}
+
+	image = std::move(result);
+	pending.clear();
+
+	// The texture has to be uploaded again
+	if (texture)
+	{
+		texture->Clear();
+		delete texture;
+		texture = NULL;
+	}
+	return true;
+}
+
+int ImageAtlas::Find(const std::string& name) const
+{
+	std::map<std::string, int>::const_iterator it = names.find(name);
+	return it != names.end() ? it->second : -1;
+}
+
+Vector4 ImageAtlas::GetUVs(int index) const
+{
+	const Region& r = regions[index];
+	return Vector4(r.x / (float)image.width, r.y / (float)image.height,
+		(r.x + r.width) / (float)image.width, (r.y + r.height) / (float)image.height);
+}
+
+Texture* ImageAtlas::GetTexture()
+{
+	if (!texture && image.pixels)
+	{
+		texture = new Texture();
+		texture->Create(image.width, image.height, GL_RGB, GL_UNSIGNED_BYTE, false, (Uint8*)image.pixels);
+	}
+	return texture;
+}
@@ -0,0 +1,74 @@
+/*
+	+ Packs many small images (icons, sprites) into a single Image using a skyline bin packer.
+	+ The region of each image can be blitted with Image::DrawImage or used as UVs of the atlas Texture.
+*/
+
+#pragma once
+
+#include "image.h"
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+class Texture;
+
+class ImageAtlas
+{
+public:
+	// Area of one packed image inside the atlas (pixels)
+	struct Region
+	{
+		int x, y;
+		int width, height;
+	};
+
+	ImageAtlas();
+	~ImageAtlas();
+
+	// Owns the GL texture
+	ImageAtlas(const ImageAtlas&) = delete;
+	ImageAtlas& operator = (const ImageAtlas&) = delete;
+
+	// Queue an image to be packed by Build (the image is only referenced until then)
+	void Add(const std::string& name, std::shared_ptr<const Image> image);
+
+	// Packs the queued images into one image at most max_width pixels wide, with padding pixels between them.
+	// The atlas is replaced by the images added since the last Build.
+	bool Build(unsigned int max_width = 1024, unsigned int padding = 1);
+
+	// Region index of an image (-1 if it is not in the atlas)
+	int Find(const std::string& name) const;
+	const Region& GetRegion(int index) const { return regions[index]; }
+
+	// UVs of a region in the atlas texture (u0, v0, u1, v1)
+	Vector4 GetUVs(int index) const;
+
+	const Image& GetImage() const { return image; }
+
+	// Single GL texture with all the images (created on first use)
+	Texture* GetTexture();
+
+private:
+	struct Item
+	{
+		std::string name;
+		std::shared_ptr<const Image> image;
+	};
+
+	// Top edge of the packed area, starting at x and 'width' pixels wide
+	struct SkylineNode
+	{
+		int x, y, width;
+	};
+
+	std::vector<Item> pending;
+	std::vector<Region> regions;
+	std::map<std::string, int> names;
+	std::vector<SkylineNode> skyline;
+	Image image;
+	Texture* texture;
+
+	bool FindPosition(int width, int height, int atlas_width, int& best_node, int& best_x, int& best_y) const;
+	void AddSkylineLevel(int node, int x, int y, int width, int height);
+};
@@ -0,0 +1,100 @@
+#include "image_cache.h"
+#include "utils.h"
+#include <list>
+#include <map>
+#include <mutex>
+
+struct CacheEntry
+{
+	std::shared_ptr<const Image> image;
+	std::list<std::string>::iterator lru; // Position in s_lru
+	size_t bytes;
+};
+
+static std::mutex s_mutex;
+static std::map<std::string, CacheEntry> s_entries;
+static std::list<std::string> s_lru; // Most recently used first
+static ImageCache::Stats s_stats = { 0, 0, 0, 0, 0, 64 * 1024 * 1024 };
+
+// Evicts unused images starting by the least recently used (s_mutex must be locked)
+static void EvictOverBudget()
+{
+	std::list<std::string>::iterator it = s_lru.end();
+	while (s_stats.bytes > s_stats.budget && it != s_lru.begin())
+	{
+		--it;
+		CacheEntry& entry = s_entries[*it];
+
+		// Only the cache holds it
+		if (entry.image.use_count() > 1)
+			continue;
+
+		s_stats.bytes -= entry.bytes;
+		s_stats.evictions++;
+		s_entries.erase(*it);
+		it = s_lru.erase(it);
+	}
+	s_stats.entries = (unsigned int)s_entries.size();
+}
+
+std::shared_ptr<const Image> ImageCache::Get(const char* filename, bool flip_y)
+{
+	// The same file flipped or not are different images
+	std::string key = absResPath(filename) + (flip_y ? "" : "|noflip");
+
+	{
+		std::lock_guard<std::mutex> lock(s_mutex);
+		std::map<std::string, CacheEntry>::iterator it = s_entries.find(key);
+		if (it != s_entries.end())
+		{
+			s_stats.hits++;
+			s_lru.splice(s_lru.begin(), s_lru, it->second.lru);
+			return it->second.image;
+		}
+		s_stats.misses++;
+	}
+
+	// Decode without holding the lock so other threads can use the cache
+	std::shared_ptr<Image> image = std::make_shared<Image>();
+	if (!image->Load(filename, flip_y))
+		return NULL;
+
+	std::lock_guard<std::mutex> lock(s_mutex);
+
+	// Another thread could have loaded it in the meantime
+	std::map<std::string, CacheEntry>::iterator it = s_entries.find(key);
+	if (it != s_entries.end())
+		return it->second.image;
+
+	s_lru.push_front(key);
+	CacheEntry& entry = s_entries[key];
+	entry.image = image;
+	entry.lru = s_lru.begin();
+	entry.bytes = image->width * image->height * sizeof(Color);
+	s_stats.bytes += entry.bytes;
+
+	EvictOverBudget();
+	return image;
+}
+
+void ImageCache::SetBudget(size_t bytes)
+{
+	std::lock_guard<std::mutex> lock(s_mutex);
+	s_stats.budget = bytes;
+	EvictOverBudget();
+}
+
+void ImageCache::Clear()
+{
+	std::lock_guard<std::mutex> lock(s_mutex);
+	size_t budget = s_stats.budget;
+	s_stats.budget = 0;
+	EvictOverBudget();
+	s_stats.budget = budget;
+}
+
+ImageCache::Stats ImageCache::GetStats()
+{
+	std::lock_guard<std::mutex> lock(s_mutex);
+	return s_stats;
+}
@@ -0,0 +1,35 @@
+/*
+	+ Cache of images loaded from disk, shared by everyone who asks for the same file (see Texture::Get for textures).
+	+ Images still referenced are kept, unused ones are evicted in LRU order when the cache goes over its memory budget.
+*/
+
+#pragma once
+
+#include "image.h"
+#include <memory>
+#include <string>
+
+class ImageCache
+{
+public:
+	struct Stats
+	{
+		unsigned int hits;
+		unsigned int misses;
+		unsigned int evictions;
+		unsigned int entries;
+		size_t bytes;   // Memory used by the cached pixels
+		size_t budget;  // Max bytes kept (images in use can go over it)
+	};
+
+	// Returns the shared image of a file (loaded on a miss with Image::Load), NULL if it could not be loaded. Thread safe.
+	static std::shared_ptr<const Image> Get(const char* filename, bool flip_y);
+
+	// Max memory used by the cache, unused images are evicted when it is exceeded
+	static void SetBudget(size_t bytes);
+
+	// Drops every image that is not in use
+	static void Clear();
+
+	static Stats GetStats();
+};
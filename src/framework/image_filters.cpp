@@ -0,0 +1,466 @@
+#include "image_filters.h"
+#include "frame_arena.h"
+#include "task_scheduler.h"
+#include "profiler.h"
+#include <cmath>
+
+// Rows per band: at least twice the rows every band reads above and below, so reading them stays cheap
+template <typename F>
+static void forEachBand(const Image& image, int radius, const F& band)
+{
+	int rows = std::max(Image::GetRowsPerTask(image.width), 4 * radius + 1);
+	TaskScheduler::Get()->ParallelFor(0, image.height, rows, band);
+}
+
+// Image to read (a copy if the filter writes on it) and dst with the size of src
+static const Image& prepare(const Image& src, Image& dst, Image& copy)
+{
+	if (&src == &dst)
+	{
+		copy = src;
+		return copy;
+	}
+	if (dst.width != src.width || dst.height != src.height)
+		dst = Image(src.width, src.height);
+	return src;
+}
+
+static inline int clampIndex(int i, int size)
+{
+	return i < 0 ? 0 : (i >= size ? size - 1 : i);
+}
+
+// Values per strip of a row in the convolution
+static const int STRIP = 256;
+
+static inline unsigned char toByte(float v)
+{
+	return (unsigned char)(std::min(std::max(v, 0.0f), 255.0f) + 0.5f);
+}
+
+void ImageFilters::ConvolveSeparable(const Image& src, Image& dst, const std::vector<float>& kernel_x, const std::vector<float>& kernel_y)
+{
+	PROFILE_SCOPE("ImageFilters::ConvolveSeparable");
+	assert(kernel_x.size() % 2 == 1 && kernel_y.size() % 2 == 1);
+
+	Image copy;
+	const Image& source = prepare(src, dst, copy);
+	const int width = source.width, height = source.height, stride = width * 3;
+	const int rx = (int)kernel_x.size() / 2, ry = (int)kernel_y.size() / 2;
+	if (width == 0 || height == 0)
+		return;
+
+	forEachBand(source, ry, [&source, &dst, &kernel_x, &kernel_y, width, height, stride, rx, ry](int y0, int y1) {
+		FrameArena::Scope scratch;
+		FrameArena* arena = FrameArena::Get();
+
+		// Rows y0 - ry .. y1 + ry filtered in x
+		const int rows = y1 - y0 + 2 * ry;
+		float* filtered = arena->Allocate<float>((size_t)rows * stride);
+		float* padded = arena->Allocate<float>((size_t)(width + 2 * rx) * 3);
+		for (int r = 0; r < rows; ++r)
+		{
+			const unsigned char* in = source.pixels[clampIndex(y0 - ry + r, height) * width].v;
+			for (int i = 0; i < rx * 3; ++i)
+			{
+				padded[i] = in[i % 3];
+				padded[(rx + width) * 3 + i] = in[(width - 1) * 3 + i % 3];
+			}
+			float* middle = padded + rx * 3;
+#pragma omp simd
+			for (int i = 0; i < stride; ++i)
+				middle[i] = in[i];
+
+			// The sums of a strip of the row stay in the cache while every tap is added
+			float* out = filtered + (size_t)r * stride;
+			for (int first = 0; first < stride; first += STRIP)
+			{
+				const int count = std::min(STRIP, stride - first);
+				float sum[STRIP] = {};
+				for (int k = 0; k <= 2 * rx; ++k)
+				{
+					const float weight = kernel_x[k];
+					const float* shifted = padded + first + k * 3;
+#pragma omp simd
+					for (int i = 0; i < count; ++i)
+						sum[i] += weight * shifted[i];
+				}
+				std::copy(sum, sum + count, out + first);
+			}
+		}
+
+		// Then in y
+		for (int y = y0; y < y1; ++y)
+		{
+			const float* rows_in = filtered + (size_t)(y - y0) * stride;
+			unsigned char* out = dst.pixels[y * width].v;
+			for (int first = 0; first < stride; first += STRIP)
+			{
+				const int count = std::min(STRIP, stride - first);
+				float sum[STRIP] = {};
+				for (int k = 0; k <= 2 * ry; ++k)
+				{
+					const float weight = kernel_y[k];
+					const float* row = rows_in + (size_t)k * stride + first;
+#pragma omp simd
+					for (int i = 0; i < count; ++i)
+						sum[i] += weight * row[i];
+				}
+#pragma omp simd
+				for (int i = 0; i < count; ++i)
+					out[first + i] = toByte(sum[i]);
+			}
+		}
+	});
+}
+
+std::vector<float> ImageFilters::GetGaussianKernel(float sigma)
+{
+	int radius = std::max((int)std::ceil(3.0f * sigma), 0);
+	std::vector<float> kernel(2 * radius + 1, 1.0f);
+	if (sigma <= 0.0f)
+		return kernel;
+
+	float total = 0.0f;
+	for (int i = -radius; i <= radius; ++i)
+		total += kernel[i + radius] = std::exp(-(float)(i * i) / (2.0f * sigma * sigma));
+	for (size_t i = 0; i < kernel.size(); ++i)
+		kernel[i] /= total;
+	return kernel;
+}
+
+void ImageFilters::BoxBlur(const Image& src, Image& dst, int radius)
+{
+	PROFILE_SCOPE("ImageFilters::BoxBlur");
+
+	Image copy;
+	const Image& source = prepare(src, dst, copy);
+	const int width = source.width, height = source.height, stride = width * 3;
+	radius = std::max(radius, 0);
+	if (width == 0 || height == 0)
+		return;
+
+	const float inv_area = 1.0f / (float)((2 * radius + 1) * (2 * radius + 1));
+
+	forEachBand(source, radius, [&source, &dst, width, height, stride, radius, inv_area](int y0, int y1) {
+		FrameArena::Scope scratch;
+		FrameArena* arena = FrameArena::Get();
+
+		// Sums of the 2 * radius + 1 pixels around in x, rows y0 - radius .. y1 + radius: the window moves one pixel,
+		// one pixel enters and one leaves
+		const int rows = y1 - y0 + 2 * radius;
+		unsigned int* filtered = arena->Allocate<unsigned int>((size_t)rows * stride);
+		unsigned int* padded = arena->Allocate<unsigned int>((size_t)(width + 2 * radius + 1) * 3);
+		const int window = (2 * radius + 1) * 3;
+		for (int r = 0; r < rows; ++r)
+		{
+			// Pixels -radius - 1 .. width + radius - 1 of the row
+			const unsigned char* in = source.pixels[clampIndex(y0 - radius + r, height) * width].v;
+			for (int i = 0; i < (radius + 1) * 3; ++i)
+				padded[i] = in[i % 3];
+#pragma omp simd
+			for (int i = 0; i < stride; ++i)
+				padded[(radius + 1) * 3 + i] = in[i];
+			for (int i = 0; i < radius * 3; ++i)
+				padded[(radius + 1 + width) * 3 + i] = in[(width - 1) * 3 + i % 3];
+
+			// The three sums stay in registers
+			unsigned int* out = filtered + (size_t)r * stride;
+			unsigned int sum[3] = { 0, 0, 0 };
+			for (int i = 3; i <= window; i += 3)
+			{
+				sum[0] += padded[i];
+				sum[1] += padded[i + 1];
+				sum[2] += padded[i + 2];
+			}
+			out[0] = sum[0]; out[1] = sum[1]; out[2] = sum[2];
+			for (int x = 1; x < width; ++x)
+			{
+				const unsigned int* enter = padded + x * 3 + window;
+				const unsigned int* leave = padded + x * 3;
+				sum[0] += enter[0] - leave[0];
+				sum[1] += enter[1] - leave[1];
+				sum[2] += enter[2] - leave[2];
+				out[x * 3] = sum[0]; out[x * 3 + 1] = sum[1]; out[x * 3 + 2] = sum[2];
+			}
+		}
+
+		// Same in y for all the columns at once
+		unsigned int* sum = arena->Allocate<unsigned int>(stride);
+		std::fill(sum, sum + stride, 0u);
+		for (int k = 0; k <= 2 * radius; ++k)
+		{
+			const unsigned int* row = filtered + (size_t)k * stride;
+#pragma omp simd
+			for (int i = 0; i < stride; ++i)
+				sum[i] += row[i];
+		}
+
+		for (int y = y0; y < y1; ++y)
+		{
+			if (y > y0)
+			{
+				const unsigned int* enter = filtered + (size_t)(y - y0 + 2 * radius) * stride;
+				const unsigned int* leave = filtered + (size_t)(y - y0 - 1) * stride;
+#pragma omp simd
+				for (int i = 0; i < stride; ++i)
+					sum[i] += enter[i] - leave[i];
+			}
+
+			unsigned char* out = dst.pixels[y * width].v;
+#pragma omp simd
+			for (int i = 0; i < stride; ++i)
+				out[i] = (unsigned char)((float)sum[i] * inv_area + 0.5f);
+		}
+	});
+}
+
+void ImageFilters::GaussianBlur(const Image& src, Image& dst, float sigma)
+{
+	PROFILE_SCOPE("ImageFilters::GaussianBlur");
+
+	// Small kernels are cheap, and boxes of a few pixels are a poor approximation
+	if (sigma < 2.0f)
+	{
+		ConvolveSeparable(src, dst, GetGaussianKernel(sigma));
+		return;
+	}
+
+	// Widths of three boxes with the variance of the Gaussian (two sizes that differ in 2)
+	const int n = 3;
+	float ideal = std::sqrt(12.0f * sigma * sigma / n + 1.0f);
+	int lower = (int)std::floor(ideal);
+	if (lower % 2 == 0)
+		lower--;
+	lower = std::max(lower, 1);
+	int upper = lower + 2;
+	int lower_boxes = (int)std::floor((12.0f * sigma * sigma - n * lower * lower - 4 * n * lower - 3 * n) / (-4.0f * lower - 4.0f) + 0.5f);
+
+	int radius[n];
+	for (int i = 0; i < n; ++i)
+		radius[i] = ((i < lower_boxes ? lower : upper) - 1) / 2;
+
+	// src is not read after the first pass, so dst can be src
+	Image temp;
+	BoxBlur(src, temp, radius[0]);
+	BoxBlur(temp, dst, radius[1]);
+	BoxBlur(dst, temp, radius[2]);
+	dst = std::move(temp);
+}
+
+void ImageFilters::Sharpen(const Image& src, Image& dst, float amount, float sigma)
+{
+	PROFILE_SCOPE("ImageFilters::Sharpen");
+
+	Image blurred;
+	GaussianBlur(src, blurred, sigma);
+	if (&dst != &src)
+		dst = src;
+
+	ForEachRowParallel(dst, blurred, [amount](Color* row, const Color* blurred_row, unsigned int width, unsigned int) {
+		unsigned char* out = row->v;
+		const unsigned char* low = blurred_row->v;
+#pragma omp simd
+		for (unsigned int i = 0; i < width * 3; ++i)
+			out[i] = toByte(out[i] + amount * ((float)out[i] - (float)low[i]));
+	});
+}
+
+void ImageFilters::Sobel(const Image& src, Image& dst, float scale)
+{
+	PROFILE_SCOPE("ImageFilters::Sobel");
+
+	Image copy;
+	const Image& source = prepare(src, dst, copy);
+	const int width = source.width, height = source.height;
+	if (width == 0 || height == 0)
+		return;
+
+	forEachBand(source, 1, [&source, &dst, width, height, scale](int y0, int y1) {
+		FrameArena::Scope scratch;
+		FrameArena* arena = FrameArena::Get();
+
+		// Luminance of rows y0 - 1 .. y1 + 1, with one more pixel at both ends
+		const int rows = y1 - y0 + 2, padded = width + 2;
+		float* luminance = arena->Allocate<float>((size_t)rows * padded);
+		for (int r = 0; r < rows; ++r)
+		{
+			const Color* in = source.pixels + clampIndex(y0 - 1 + r, height) * width;
+			float* out = luminance + (size_t)r * padded + 1;
+#pragma omp simd
+			for (int x = 0; x < width; ++x)
+				out[x] = 0.299f * in[x].r + 0.587f * in[x].g + 0.114f * in[x].b;
+			out[-1] = out[0];
+			out[width] = out[width - 1];
+		}
+
+		float* magnitude = arena->Allocate<float>(width);
+		for (int y = y0; y < y1; ++y)
+		{
+			const float* a = luminance + (size_t)(y - y0) * padded;
+			const float* b = a + padded;
+			const float* c = b + padded;
+#pragma omp simd
+			for (int x = 0; x < width; ++x)
+			{
+				float gx = (a[x + 2] + 2.0f * b[x + 2] + c[x + 2]) - (a[x] + 2.0f * b[x] + c[x]);
+				float gy = (c[x] + 2.0f * c[x + 1] + c[x + 2]) - (a[x] + 2.0f * a[x + 1] + a[x + 2]);
+				magnitude[x] = scale * std::sqrt(gx * gx + gy * gy);
+			}
+
+			unsigned char* out = dst.pixels[y * width].v;
+			for (int x = 0; x < width; ++x)
+				out[x * 3] = out[x * 3 + 1] = out[x * 3 + 2] = toByte(magnitude[x]);
+		}
+	});
+}
+
+static inline void sort2(unsigned char& a, unsigned char& b)
+{
+	unsigned char low = std::min(a, b);
+	b = std::max(a, b);
+	a = low;
+}
+
+// 3x3 median with a sorting network (19 min/max), the same operations for every byte of the row so it is vectorized
+static void median3x3(const Image& source, Image& dst)
+{
+	const int width = source.width, height = source.height, stride = width * 3;
+
+	forEachBand(source, 1, [&source, &dst, width, height, stride](int y0, int y1) {
+		FrameArena::Scope scratch;
+
+		// Rows y0 - 1 .. y1 with one more pixel at both ends
+		const int padded_stride = stride + 6;
+		unsigned char* padded = FrameArena::Get()->Allocate<unsigned char>((size_t)(y1 - y0 + 2) * padded_stride);
+		for (int r = 0; r < y1 - y0 + 2; ++r)
+		{
+			const unsigned char* in = source.pixels[clampIndex(y0 - 1 + r, height) * width].v;
+			unsigned char* out = padded + (size_t)r * padded_stride;
+			memcpy(out + 3, in, stride);
+			for (int c = 0; c < 3; ++c)
+			{
+				out[c] = in[c];
+				out[stride + 3 + c] = in[stride - 3 + c];
+			}
+		}
+
+		for (int y = y0; y < y1; ++y)
+		{
+			const unsigned char* a = padded + (size_t)(y - y0) * padded_stride;
+			const unsigned char* b = a + padded_stride;
+			const unsigned char* c = b + padded_stride;
+			unsigned char* out = dst.pixels[y * width].v;
+#pragma omp simd
+			for (int i = 0; i < stride; ++i)
+			{
+				unsigned char p0 = a[i], p1 = a[i + 3], p2 = a[i + 6];
+				unsigned char p3 = b[i], p4 = b[i + 3], p5 = b[i + 6];
+				unsigned char p6 = c[i], p7 = c[i + 3], p8 = c[i + 6];
+				sort2(p1, p2); sort2(p4, p5); sort2(p7, p8);
+				sort2(p0, p1); sort2(p3, p4); sort2(p6, p7);
+				sort2(p1, p2); sort2(p4, p5); sort2(p7, p8);
+				sort2(p0, p3); sort2(p5, p8); sort2(p4, p7);
+				sort2(p3, p6); sort2(p1, p4); sort2(p2, p5);
+				sort2(p4, p7); sort2(p4, p2); sort2(p6, p4);
+				sort2(p4, p2);
+				out[i] = p4;
+			}
+		}
+	});
+}
+
+void ImageFilters::Median(const Image& src, Image& dst, int radius)
+{
+	PROFILE_SCOPE("ImageFilters::Median");
+
+	Image copy;
+	const Image& source = prepare(src, dst, copy);
+	const int width = source.width, height = source.height;
+	radius = std::max(radius, 0);
+	if (width == 0 || height == 0)
+		return;
+
+	if (radius == 1)
+	{
+		median3x3(source, dst);
+		return;
+	}
+
+	// The median is the value at position 'half' of the sorted window
+	const int half = (2 * radius + 1) * (2 * radius + 1) / 2;
+
+	forEachBand(source, 0, [&source, &dst, width, height, radius, half](int y0, int y1) {
+		FrameArena::Scope scratch;
+		const unsigned char** rows = FrameArena::Get()->Allocate<const unsigned char*>(2 * radius + 1);
+
+		for (int y = y0; y < y1; ++y)
+		{
+			for (int k = 0; k <= 2 * radius; ++k)
+				rows[k] = source.pixels[clampIndex(y - radius + k, height) * width].v;
+
+			// Histogram of the window of every channel, moved along the row: a column leaves and one enters.
+			// The median is tracked with the number of values below it, moving by 16 values where it can.
+			int histogram[3][256] = {};
+			int coarse[3][16] = {};
+			int median[3] = { 0, 0, 0 }, below[3] = { 0, 0, 0 };
+			unsigned char* out = dst.pixels[y * width].v;
+
+			for (int x = 0; x < width; ++x)
+			{
+				for (int c = 0; c < 3; ++c)
+				{
+					int* h = histogram[c];
+					int* h16 = coarse[c];
+					if (x == 0)
+					{
+						for (int k = 0; k <= 2 * radius; ++k)
+							for (int dx = -radius; dx <= radius; ++dx)
+							{
+								int value = rows[k][clampIndex(dx, width) * 3 + c];
+								h[value]++;
+								h16[value >> 4]++;
+							}
+					}
+					else
+					{
+						const int leave = clampIndex(x - radius - 1, width) * 3 + c, enter = clampIndex(x + radius, width) * 3 + c;
+						for (int k = 0; k <= 2 * radius; ++k)
+						{
+							int old_value = rows[k][leave], new_value = rows[k][enter];
+							h[old_value]--;
+							h16[old_value >> 4]--;
+							h[new_value]++;
+							h16[new_value >> 4]++;
+							below[c] += (new_value < median[c]) - (old_value < median[c]);
+						}
+					}
+
+					int& m = median[c];
+					int& count = below[c];
+					while (count > half)
+					{
+						if ((m & 15) == 0 && count - h16[(m >> 4) - 1] > half)
+						{
+							count -= h16[(m >> 4) - 1];
+							m -= 16;
+						}
+						else
+							count -= h[--m];
+					}
+					while (count + h[m] <= half)
+					{
+						if ((m & 15) == 0 && count + h16[m >> 4] <= half)
+						{
+							count += h16[m >> 4];
+							m += 16;
+						}
+						else
+							count += h[m++];
+					}
+					out[x * 3 + c] = (unsigned char)m;
+				}
+			}
+		}
+	});
+}
@@ -0,0 +1,38 @@
+/*
+	+ Image filters: separable convolution, box blur, Gaussian blur, sharpen, Sobel edges and median.
+	+ The image is split in bands of rows filtered in parallel by the TaskScheduler. Every band reads the rows it needs
+	  above and below, pixels outside the image repeat the closest edge pixel.
+	+ The result is written in dst (resized to the size of src if needed), which can be the same image as src.
+*/
+
+#pragma once
+
+#include "image.h"
+#include <vector>
+
+class ImageFilters
+{
+public:
+	// Kernels of odd size applied in x and then in y, e.g. { 0.25f, 0.5f, 0.25f }
+	static void ConvolveSeparable(const Image& src, Image& dst, const std::vector<float>& kernel_x, const std::vector<float>& kernel_y);
+	static void ConvolveSeparable(const Image& src, Image& dst, const std::vector<float>& kernel) { ConvolveSeparable(src, dst, kernel, kernel); }
+
+	// Sampled Gaussian of radius 3 * sigma, normalized
+	static std::vector<float> GetGaussianKernel(float sigma);
+
+	// Average of the (2 * radius + 1)^2 pixels around: running sums, the cost does not depend on the radius
+	static void BoxBlur(const Image& src, Image& dst, int radius);
+
+	// Gaussian blur: exact kernel for sigma < 2, above it three box blurs with the same variance (cost independent of
+	// sigma, for an exact result use ConvolveSeparable and GetGaussianKernel)
+	static void GaussianBlur(const Image& src, Image& dst, float sigma);
+
+	// Unsharp mask: src + amount * (src - blurred src)
+	static void Sharpen(const Image& src, Image& dst, float amount = 1.0f, float sigma = 1.0f);
+
+	// Magnitude of the gradient of the luminance (gray image), multiplied by scale and clamped to 255
+	static void Sobel(const Image& src, Image& dst, float scale = 1.0f);
+
+	// Median of every channel in the (2 * radius + 1)^2 pixels around: sorting network for radius 1, sliding histograms above
+	static void Median(const Image& src, Image& dst, int radius);
+};
@@ -0,0 +1,49 @@
+#include "image_loader.h"
+#include "task_scheduler.h"
+#include "image_cache.h"
+#include <atomic>
+#include <memory>
+#include <string>
+
+static std::atomic<unsigned int> s_pending_loads(0);
+
+void ImageLoader::LoadAsync(const char* filename, Callback callback, bool flip_y)
+{
+	std::string name = filename;
+	s_pending_loads++;
+
+	TaskScheduler::Get()->Submit([name, callback, flip_y]()
+	{
+		std::shared_ptr<Image> image = std::make_shared<Image>();
+		bool success = image->Load(name.c_str(), flip_y);
+
+		// Hand the decoded image to the main thread
+		TaskScheduler::Get()->RunOnMainThread([image, callback, success]()
+		{
+			s_pending_loads--;
+			callback(*image, success);
+		});
+	});
+}
+
+void ImageLoader::GetAsync(const char* filename, SharedCallback callback, bool flip_y)
+{
+	std::string name = filename;
+	s_pending_loads++;
+
+	TaskScheduler::Get()->Submit([name, callback, flip_y]()
+	{
+		std::shared_ptr<const Image> image = ImageCache::Get(name.c_str(), flip_y);
+
+		TaskScheduler::Get()->RunOnMainThread([image, callback]()
+		{
+			s_pending_loads--;
+			callback(image);
+		});
+	});
+}
+
+unsigned int ImageLoader::GetPendingLoads()
+{
+	return s_pending_loads;
+}
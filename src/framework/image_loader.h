@@ -0,0 +1,29 @@
+/*
+	+ Loads images in the background using the TaskScheduler workers.
+	+ The callbacks are executed in the main thread (see TaskScheduler::PumpMainThread) once the image is decoded.
+*/
+
+#pragma once
+
+#include "image.h"
+#include <functional>
+#include <memory>
+
+class ImageLoader
+{
+public:
+	// The loaded image can be moved out of the callback argument. success is false if the file could not be loaded.
+	typedef std::function<void(Image& image, bool success)> Callback;
+
+	// Shared image from the ImageCache (NULL if the file could not be loaded)
+	typedef std::function<void(std::shared_ptr<const Image> image)> SharedCallback;
+
+	// Decodes a PNG or TGA file (by extension, see Image::Load) in a worker thread
+	static void LoadAsync(const char* filename, Callback callback, bool flip_y);
+
+	// Same but the image comes from the ImageCache, files already loaded are not decoded again
+	static void GetAsync(const char* filename, SharedCallback callback, bool flip_y);
+
+	// Number of loads that did not deliver their callback yet
+	static unsigned int GetPendingLoads();
+};
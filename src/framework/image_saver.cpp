@@ -0,0 +1,114 @@
+#include "image_saver.h"
+#include "task_scheduler.h"
+#include "utils.h"
+#include <atomic>
+#include <memory>
+#include <cstdio>
+#include <iostream>
+
+// Data shared between the main thread and the worker doing the save
+struct SaveJob
+{
+	unsigned int id;
+	std::string filename;
+	Image snapshot;
+	std::atomic<float> progress;
+	bool success = false;
+};
+
+// Only accessed from the main thread
+static std::vector<std::shared_ptr<SaveJob>> s_jobs;
+static std::vector<Image> s_free_snapshots; // Buffers of finished saves ready to be reused
+static const size_t MAX_FREE_SNAPSHOTS = 2;
+static unsigned int s_next_id = 1;
+
+// Copies the image into a recycled buffer of the same size if there is one
+static void TakeSnapshot(const Image& image, Image& snapshot)
+{
+	for (size_t i = 0; i < s_free_snapshots.size(); ++i)
+	{
+		Image& buffer = s_free_snapshots[i];
+		if (buffer.width != image.width || buffer.height != image.height)
+			continue;
+
+		snapshot = std::move(buffer);
+		s_free_snapshots.erase(s_free_snapshots.begin() + i);
+		memcpy(snapshot.pixels, image.pixels, image.width * image.height * sizeof(Color));
+		return;
+	}
+
+	snapshot = image;
+}
+
+unsigned int ImageSaver::SaveAsync(const Image& image, const char* filename, Callback callback)
+{
+	std::shared_ptr<SaveJob> job = std::make_shared<SaveJob>();
+	job->id = s_next_id++;
+	job->filename = filename;
+	job->progress = 0.0f;
+	TakeSnapshot(image, job->snapshot);
+	s_jobs.push_back(job);
+
+	TaskScheduler::Get()->Submit([job, callback]()
+	{
+		// Write to a temporary file so concurrent saves to the same file never mix their data
+		std::string tmp_name = job->filename + "." + std::to_string(job->id) + ".tmp";
+		Image::ProgressCallback progress = [job](float p) { job->progress = p; };
+
+		const std::string& name = job->filename;
+		bool is_png = name.size() >= 4 && name.compare(name.size() - 4, 4, ".png") == 0;
+		// Already on a worker: encode on this thread only, concurrent saves keep the other cores busy.
+		// The writers do not log, the final name is logged once the file is in place.
+		bool success = is_png ? job->snapshot.WritePNG(tmp_name.c_str(), 6, true, progress, 1) : job->snapshot.WriteTGA(tmp_name.c_str(), false, progress);
+
+		std::string tmp_path = absResPath(tmp_name);
+		std::string path = absResPath(name);
+		if (success)
+		{
+			remove(path.c_str());
+			success = rename(tmp_path.c_str(), path.c_str()) == 0;
+		}
+
+		if (success)
+			std::cout << "+++ File saved: " << path.c_str() << std::endl;
+		else
+		{
+			std::cerr << "--- Failed to save file: " << path.c_str() << std::endl;
+			remove(tmp_path.c_str());
+		}
+
+		job->success = success;
+		job->progress = 1.0f;
+
+		TaskScheduler::Get()->RunOnMainThread([job, callback]()
+		{
+			for (size_t i = 0; i < s_jobs.size(); ++i)
+				if (s_jobs[i] == job) { s_jobs.erase(s_jobs.begin() + i); break; }
+
+			// Keep the snapshot buffer for the next save
+			if (s_free_snapshots.size() < MAX_FREE_SNAPSHOTS)
+				s_free_snapshots.push_back(std::move(job->snapshot));
+
+			if (callback)
+				callback(job->success);
+		});
+	});
+
+	return job->id;
+}
+
+std::vector<ImageSaver::SaveStatus> ImageSaver::GetActiveSaves()
+{
+	std::vector<SaveStatus> result;
+	for (size_t i = 0; i < s_jobs.size(); ++i)
+	{
+		SaveStatus status = { s_jobs[i]->id, s_jobs[i]->filename, s_jobs[i]->progress };
+		result.push_back(status);
+	}
+	return result;
+}
+
+unsigned int ImageSaver::GetPendingSaves()
+{
+	return (unsigned int)s_jobs.size();
+}
@@ -0,0 +1,33 @@
+/*
+	+ Saves images in the background using the TaskScheduler workers.
+	+ The image is copied into a snapshot buffer (buffers are reused between saves) so the caller can keep drawing.
+*/
+
+#pragma once
+
+#include "image.h"
+#include <functional>
+#include <string>
+#include <vector>
+
+class ImageSaver
+{
+public:
+	// Called in the main thread when the file has been written
+	typedef std::function<void(bool success)> Callback;
+
+	// State of a save that is still running
+	struct SaveStatus
+	{
+		unsigned int id;
+		std::string filename;
+		float progress; // 0..1
+	};
+
+	// Saves a PNG (".png") or TGA (any other extension) file in a worker thread. Returns the id of the save.
+	static unsigned int SaveAsync(const Image& image, const char* filename, Callback callback = Callback());
+
+	// Saves that did not finish yet (main thread only)
+	static std::vector<SaveStatus> GetActiveSaves();
+	static unsigned int GetPendingSaves();
+};
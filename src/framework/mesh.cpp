@@ -1,6 +1,8 @@
 #include "mesh.h"
 #include "utils.h"
 #include "camera.h"
+#include "frame_arena.h"
+#include "task_scheduler.h"
 
 #include <string>
 #include <sys/stat.h>
@@ -17,6 +19,7 @@ void Mesh::Clear()
 	uvs.clear();
 }
 
+#ifndef CG_HEADLESS
 void Mesh::Render(int primitive)
 {
 	// Render the mesh using your rasterizer
@@ -45,6 +48,7 @@ void Mesh::Render(int primitive)
 	if (uvs.size())
 		glDisableClientState(GL_TEXTURE_COORD_ARRAY);
 }
+#endif
 
 void Mesh::CreateQuad()
 {
@@ -238,109 +242,181 @@ void Mesh::CreateCube(float size)
 	uvs.push_back(Vector2(0, 0));
 }
 
-bool Mesh::LoadOBJ(const char* filename)
+// Lines of an OBJ file parsed by one task: the indexed data in file order and the triangles of the faces
+struct OBJChunk
 {
-	struct stat stbuffer;
-	std::cout << "Loading mesh: " << filename << std::endl;
+	const char* begin;
+	const char* end;
 
-	std::string relPath = absResPath(filename);
+	std::vector<Vector3> positions;
+	std::vector<Vector3> normals;
+	std::vector<Vector2> uvs;
 
-	FILE* f = fopen(relPath.c_str(), "rb");
-	if (f == NULL)
-	{
-		std::cerr << "File not found: " << filename << std::endl;
-		return false;
-	}
+	std::vector<Vector3> corners;           // Indices (position/uv/normal, from 1) of the 3 corners of every triangle
+	std::vector<unsigned char> known;       // Per triangle: 1 if this chunk had uvs before it, 2 normals
 
-	stat(relPath.c_str(), &stbuffer);
+	size_t first_vertex, first_uv, first_normal;    // Where its triangles go in the mesh
+	bool uvs_before, normals_before;                // Previous chunks had uvs/normals
+};
 
-	unsigned int size = stbuffer.st_size;
-	char* data = new char[size + 1];
-	fread(data, size, 1, f);
-	fclose(f);
-	data[size] = 0;
+// Minimum size of a chunk, smaller files are parsed by the calling thread
+static const size_t OBJ_CHUNK_SIZE = 256 * 1024;
 
-	char* pos = data;
+static void parseOBJChunk(OBJChunk& chunk)
+{
+	const char* pos = chunk.begin;
 	char line[255];
 	int i = 0;
 
-	std::vector<Vector3> indexed_positions;
-	std::vector<Vector3> indexed_normals;
-	std::vector<Vector2> indexed_uvs;
-
-	const float max_float = 10000000;
-	const float min_float = -10000000;
-
-	unsigned int vertex_i = 0;
-
-	//parse file
-	while (*pos != 0)
+	while (pos < chunk.end)
 	{
 		if (*pos == '\n') pos++;
 		if (*pos == '\r') pos++;
 
 		//read one line
 		i = 0;
-		while (i < 255 && pos[i] != '\n' && pos[i] != '\r' && pos[i] != 0) i++;
+		while (i < 255 && pos + i < chunk.end && pos[i] != '\n' && pos[i] != '\r' && pos[i] != 0) i++;
 		std::memcpy(line, pos, i);
 		line[i] = 0;
 		pos = pos + i;
 
-		//std::cout << "Line: \"" << line << "\"" << std::endl;
 		if (*line == '#' || *line == 0) continue; //comment
 
-		//tokenize line
-		std::vector<std::string> tokens = tokenize(line, " ");
+		//tokenize line (the tokens live in the frame arena until the end of the line)
+		FrameArena::Scope scratch;
+		const char* tokens[128];
+		int num_tokens = tokenize(line, " ", tokens, 128);
 
-		if (tokens.empty()) continue;
+		if (num_tokens == 0) continue;
 
-		if (tokens[0] == "v" && tokens.size() == 4)
+		if (strcmp(tokens[0], "v") == 0 && num_tokens == 4)
 		{
-			Vector3 v(std::stof(tokens[1].c_str()), std::stof(tokens[2].c_str()), std::stof(tokens[3].c_str()));
-			indexed_positions.push_back(v);
+			Vector3 v(strtof(tokens[1], NULL), strtof(tokens[2], NULL), strtof(tokens[3], NULL));
+			chunk.positions.push_back(v);
 		}
-		else if (tokens[0] == "vt" && (tokens.size() == 4 || tokens.size() == 3))
+		else if (strcmp(tokens[0], "vt") == 0 && (num_tokens == 4 || num_tokens == 3))
 		{
-			Vector2 v(std::stof(tokens[1].c_str()), std::stof(tokens[2].c_str()));
-			indexed_uvs.push_back(v);
+			Vector2 v(strtof(tokens[1], NULL), strtof(tokens[2], NULL));
+			chunk.uvs.push_back(v);
 		}
-		else if (tokens[0] == "vn" && tokens.size() == 4)
+		else if (strcmp(tokens[0], "vn") == 0 && num_tokens == 4)
 		{
-			Vector3 v(std::stof(tokens[1].c_str()), std::stof(tokens[2].c_str()), std::stof(tokens[3].c_str()));
-			indexed_normals.push_back(v);
+			Vector3 v(strtof(tokens[1], NULL), strtof(tokens[2], NULL), strtof(tokens[3], NULL));
+			chunk.normals.push_back(v);
 		}
-		else if (tokens[0] == "f" && tokens.size() >= 4)
+		else if (strcmp(tokens[0], "f") == 0 && num_tokens >= 4)
 		{
-			Vector3 v1, v2, v3;
-			v1 = parseVector3(tokens[1].c_str(), '/');
+			Vector3 v1 = parseVector3(tokens[1], '/');
+			unsigned char known = (chunk.uvs.size() > 0 ? 1 : 0) | (chunk.normals.size() > 0 ? 2 : 0);
 
-			for (size_t iPoly = 2; iPoly < tokens.size() - 1; iPoly++)
+			for (int iPoly = 2; iPoly < num_tokens - 1; iPoly++)
 			{
-				v2 = parseVector3(tokens[iPoly].c_str(), '/');
-				v3 = parseVector3(tokens[iPoly + 1].c_str(), '/');
-
-				vertices.push_back(indexed_positions[(unsigned int)(v1.x) - 1]);
-				vertices.push_back(indexed_positions[(unsigned int)(v2.x) - 1]);
-				vertices.push_back(indexed_positions[(unsigned int)(v3.x) - 1]);
-				//triangles.push_back( VECTOR_INDICES_TYPE(vertex_i, vertex_i+1, vertex_i+2) ); //not needed
-				vertex_i += 3;
-
-				if (indexed_uvs.size() > 0)
-				{
-					uvs.push_back(indexed_uvs[(unsigned int)(v1.y) - 1]);
-					uvs.push_back(indexed_uvs[(unsigned int)(v2.y) - 1]);
-					uvs.push_back(indexed_uvs[(unsigned int)(v3.y) - 1]);
-				}
-
-				if (indexed_normals.size() > 0)
-				{
-					normals.push_back(indexed_normals[(unsigned int)(v1.z) - 1]);
-					normals.push_back(indexed_normals[(unsigned int)(v2.z) - 1]);
-					normals.push_back(indexed_normals[(unsigned int)(v3.z) - 1]);
-				}
+				chunk.corners.push_back(v1);
+				chunk.corners.push_back(parseVector3(tokens[iPoly], '/'));
+				chunk.corners.push_back(parseVector3(tokens[iPoly + 1], '/'));
+				chunk.known.push_back(known);
 			}
 		}
 	}
+}
+
+bool Mesh::LoadOBJ(const char* filename)
+{
+	struct stat stbuffer;
+	std::cout << "Loading mesh: " << filename << std::endl;
+
+	std::string relPath = absResPath(filename);
+
+	FILE* f = fopen(relPath.c_str(), "rb");
+	if (f == NULL)
+	{
+		std::cerr << "File not found: " << filename << std::endl;
+		return false;
+	}
+
+	stat(relPath.c_str(), &stbuffer);
+
+	unsigned int size = stbuffer.st_size;
+	char* data = new char[size + 1];
+	fread(data, size, 1, f);
+	fclose(f);
+	data[size] = 0;
+
+	// Split the file in chunks that start at a line break, parsed in parallel
+	TaskScheduler* scheduler = TaskScheduler::Get();
+	size_t num_chunks = std::max(std::min((size_t)size / OBJ_CHUNK_SIZE, (size_t)scheduler->GetNumThreads() * 4 + 4), (size_t)1);
+	std::vector<OBJChunk> chunks;
+	const char* end = data + strlen(data);
+	const char* pos = data;
+	while (pos < end)
+	{
+		OBJChunk chunk = OBJChunk();
+		chunk.begin = pos;
+		const char* target = data + (size_t)size * (chunks.size() + 1) / num_chunks;
+		pos = std::max(pos + 1, target);
+		while (pos < end && *pos != '\n') pos++;
+		chunk.end = std::min(pos, end);
+		chunks.push_back(chunk);
+	}
+
+	scheduler->ParallelFor(0, (int)chunks.size(), 1, [&](int first, int last) {
+		for (int c = first; c < last; ++c)
+			parseOBJChunk(chunks[c]);
+	});
+
+	// Join the indexed data and find where the triangles of every chunk go
+	std::vector<Vector3> indexed_positions;
+	std::vector<Vector3> indexed_normals;
+	std::vector<Vector2> indexed_uvs;
+
+	size_t num_vertices = vertices.size(), num_uvs = uvs.size(), num_normals = normals.size();
+	for (size_t c = 0; c < chunks.size(); ++c)
+	{
+		OBJChunk& chunk = chunks[c];
+		chunk.uvs_before = indexed_uvs.size() > 0;
+		chunk.normals_before = indexed_normals.size() > 0;
+		chunk.first_vertex = num_vertices;
+		chunk.first_uv = num_uvs;
+		chunk.first_normal = num_normals;
+
+		// uvs/normals are only added to the triangles after the first one in the file
+		for (size_t t = 0; t < chunk.known.size(); ++t)
+		{
+			num_vertices += 3;
+			num_uvs += (chunk.uvs_before || (chunk.known[t] & 1)) ? 3 : 0;
+			num_normals += (chunk.normals_before || (chunk.known[t] & 2)) ? 3 : 0;
+		}
+
+		indexed_positions.insert(indexed_positions.end(), chunk.positions.begin(), chunk.positions.end());
+		indexed_normals.insert(indexed_normals.end(), chunk.normals.begin(), chunk.normals.end());
+		indexed_uvs.insert(indexed_uvs.end(), chunk.uvs.begin(), chunk.uvs.end());
+	}
+
+	vertices.resize(num_vertices);
+	uvs.resize(num_uvs);
+	normals.resize(num_normals);
+
+	scheduler->ParallelFor(0, (int)chunks.size(), 1, [&](int first, int last) {
+		for (int c = first; c < last; ++c)
+		{
+			const OBJChunk& chunk = chunks[c];
+			size_t vertex_i = chunk.first_vertex, uv_i = chunk.first_uv, normal_i = chunk.first_normal;
+			for (size_t t = 0; t < chunk.known.size(); ++t)
+			{
+				const Vector3* corner = &chunk.corners[t * 3];
+				for (int k = 0; k < 3; ++k)
+					vertices[vertex_i++] = indexed_positions[(unsigned int)(corner[k].x) - 1];
+
+				if (chunk.uvs_before || (chunk.known[t] & 1))
+					for (int k = 0; k < 3; ++k)
+						uvs[uv_i++] = indexed_uvs[(unsigned int)(corner[k].y) - 1];
+
+				if (chunk.normals_before || (chunk.known[t] & 2))
+					for (int k = 0; k < 3; ++k)
+						normals[normal_i++] = indexed_normals[(unsigned int)(corner[k].z) - 1];
+			}
+		}
+	});
 
 	delete[] data;
 
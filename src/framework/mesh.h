@@ -19,7 +19,9 @@ public:
 
 	Mesh();
 	void Clear();
+#ifndef CG_HEADLESS
 	void Render(int primitive = GL_TRIANGLES);
+#endif
 
 	void CreatePlane(float size);
 	void CreateCube(float size);
@@ -1,71 +1,673 @@
 #include "particle_system.h"
-#include <cstdlib>   // rand
+#include "task_scheduler.h"
+#include "profiler.h"
+#include <cstdlib>   // posix_memalign
+#include <cstring>   // memcpy
 #include <algorithm> // std::min/std::max
 
-static float frand01()
+#ifdef WIN32
+#include <malloc.h>  // _aligned_malloc
+#endif
+
+// Definitions of the constants (std::min/std::max take them by reference)
+const int ParticleSystem::DEFAULT_CAPACITY;
+const int ParticleSystem::SPLAT_SUBPIXEL;
+const int ParticleSystem::SPLAT_TILE;
+const int ParticleSystem::SPLAT_MAX_RADIUS;
+const int ParticleSystem::PARALLEL_THRESHOLD;
+const int ParticleSystem::PARALLEL_GRAIN;
+
+// Cache line aligned arrays (needed for aligned SIMD loads)
+static void* AlignedAlloc(size_t bytes)
+{
+#ifdef WIN32
+    return _aligned_malloc(bytes, 64);
+#else
+    void* ptr = nullptr;
+    if (posix_memalign(&ptr, 64, bytes) != 0)
+        return nullptr;
+    return ptr;
+#endif
+}
+
+static void AlignedFree(void* ptr)
+{
+#ifdef WIN32
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+ParticleSystem::ParticleSystem()
+{
+    Allocate(DEFAULT_CAPACITY);
+}
+
+ParticleSystem::~ParticleSystem()
+{
+    Free();
+}
+
+void ParticleSystem::Allocate(int new_capacity)
+{
+    // Keep the alive particles that fit
+    int keep = std::min(count, new_capacity);
+    size_t n = (size_t)std::max(new_capacity, 1);
+
+    float* arrays[7] = { posX, posY, prevX, prevY, velX, velY, ttl };
+    float** targets[7] = { &posX, &posY, &prevX, &prevY, &velX, &velY, &ttl };
+    for (int k = 0; k < 7; ++k)
+    {
+        float* a = (float*)AlignedAlloc(n * sizeof(float));
+        if (arrays[k]) memcpy(a, arrays[k], keep * sizeof(float));
+        AlignedFree(arrays[k]);
+        *targets[k] = a;
+    }
+
+    Color* c = (Color*)AlignedAlloc(n * sizeof(Color));
+    if (color) memcpy((void*)c, color, keep * sizeof(Color));
+    AlignedFree(color);
+    color = c;
+
+    count = keep;
+    capacity = new_capacity;
+}
+
+void ParticleSystem::Free()
 {
-    // Random float in [0,1)
-    return (rand() % 10000) / 10000.0f;
+    AlignedFree(posX); AlignedFree(posY);
+    AlignedFree(prevX); AlignedFree(prevY);
+    AlignedFree(velX); AlignedFree(velY);
+    AlignedFree(ttl);
+    AlignedFree(color);
+    posX = posY = prevX = prevY = velX = velY = ttl = nullptr;
+    color = nullptr;
+    count = capacity = 0;
+}
+
+void ParticleSystem::SetCapacity(int new_capacity)
+{
+    if (new_capacity != capacity)
+        Allocate(std::max(new_capacity, 0));
+}
+
+void ParticleSystem::Kill(int i)
+{
+    // Move the last alive particle into the hole
+    int last = --count;
+    posX[i] = posX[last];
+    posY[i] = posY[last];
+    prevX[i] = prevX[last];
+    prevY[i] = prevY[last];
+    velX[i] = velX[last];
+    velY[i] = velY[last];
+    ttl[i] = ttl[last];
+    color[i] = color[last];
+}
+
+ParticleEmitter ParticleSystem::Starfield(int width)
+{
+    // Stars along the top edge drifting down, spawned as fast as they die
+    ParticleEmitter e;
+    e.shape = ParticleEmitter::LINE;
+    e.position = Vector2(0.0f, 0.0f);
+    e.size = Vector2((float)width, 0.0f);
+    e.rate = -1.0f;
+    e.velocity = ParticleEmitter::BOX;
+    e.velocityMin = Vector2(-30.0f, 50.0f);
+    e.velocityMax = Vector2(30.0f, 200.0f);
+    e.ttlMin = 5.0f;
+    e.ttlMax = 10.0f;
+    e.colorMin = Color(180, 180, 180);
+    e.colorMax = Color(255, 255, 255);
+    return e;
+}
+
+void ParticleSystem::SpawnRange(Rng& rng, const ParticleEmitter& e, int begin, int end, int width, int height, bool anywhere)
+{
+    // Attributes are generated in batches straight into the arrays (used as scratch for the shape/cone parameters)
+    int n = end - begin;
+    float* px = posX + begin;
+    float* py = posY + begin;
+    float* vx = velX + begin;
+    float* vy = velY + begin;
+
+    if (anywhere)
+    {
+        rng.FillRange(px, n, 0.0f, (float)width);
+        rng.FillRange(py, n, 0.0f, (float)height);
+    }
+    else if (e.shape == ParticleEmitter::POINT)
+    {
+        std::fill(px, px + n, e.position.x);
+        std::fill(py, py + n, e.position.y);
+    }
+    else if (e.shape == ParticleEmitter::LINE)
+    {
+        rng.Fill(px, n);
+        for (int i = 0; i < n; ++i)
+        {
+            py[i] = e.position.y + px[i] * e.size.y;
+            px[i] = e.position.x + px[i] * e.size.x;
+        }
+    }
+    else if (e.shape == ParticleEmitter::RECT)
+    {
+        rng.FillRange(px, n, e.position.x, e.position.x + e.size.x);
+        rng.FillRange(py, n, e.position.y, e.position.y + e.size.y);
+    }
+    else // CIRCLE, uniform over the disc
+    {
+        rng.Fill(px, n);
+        rng.FillRange(py, n, 0.0f, 2.0f * PI);
+        for (int i = 0; i < n; ++i)
+        {
+            float r = e.size.x * sqrtf(px[i]);
+            float a = py[i];
+            px[i] = e.position.x + r * cosf(a);
+            py[i] = e.position.y + r * sinf(a);
+        }
+    }
+
+    if (e.velocity == ParticleEmitter::BOX)
+    {
+        rng.FillRange(vx, n, e.velocityMin.x, e.velocityMax.x);
+        rng.FillRange(vy, n, e.velocityMin.y, e.velocityMax.y);
+    }
+    else
+    {
+        rng.FillRange(vx, n, e.angle - e.spread, e.angle + e.spread);
+        rng.FillRange(vy, n, e.speedMin, e.speedMax);
+        for (int i = 0; i < n; ++i)
+        {
+            float a = vx[i], speed = vy[i];
+            vx[i] = speed * cosf(a);
+            vy[i] = speed * sinf(a);
+        }
+    }
+
+    rng.FillRange(ttl + begin, n, e.ttlMin, e.ttlMax);
+
+    // Born this step, nothing to interpolate from
+    memcpy(prevX + begin, px, n * sizeof(float));
+    memcpy(prevY + begin, py, n * sizeof(float));
+
+    const Color& c0 = e.colorMin;
+    const Color& c1 = e.colorMax;
+    for (int i = begin; i < end; ++i)
+    {
+        float t = rng.NextFloat();
+        color[i] = Color(c0.r + (c1.r - c0.r) * t, c0.g + (c1.g - c0.g) * t, c0.b + (c1.b - c0.b) * t);
+    }
+}
+
+void ParticleSystem::Spawn(const ParticleEmitter& emitter, int amount, int width, int height, bool anywhere)
+{
+    amount = std::min(amount, capacity - count);
+    if (amount <= 0)
+        return;
+
+    int first = count;
+    count += amount;
+
+    // One random stream per range (the same ranges are used whatever the number of threads)
+    uint64_t batch = spawnBatch++;
+    auto spawn = [&](int begin, int end) {
+        Rng rng(seed, (batch << 20) + (uint64_t)(begin - first) / PARALLEL_GRAIN);
+        SpawnRange(rng, emitter, begin, end, width, height, anywhere);
+    };
+
+    if (amount < PARALLEL_THRESHOLD)
+    {
+        for (int begin = first; begin < count; begin += PARALLEL_GRAIN)
+            spawn(begin, std::min(begin + PARALLEL_GRAIN, count));
+    }
+    else
+        TaskScheduler::Get()->ParallelFor(first, count, PARALLEL_GRAIN, spawn);
 }
 
 void ParticleSystem::Init(int width, int height)
 {
-    // Init starfield particles
-    for (int i = 0; i < MAX_PARTICLES; ++i)
+    count = 0;
+    if (emitters.empty())
+        AddEmitter(Starfield(width));
+
+    // Fill the screen at start for the emitters that keep the system full
+    for (size_t k = 0; k < emitters.size(); ++k)
+    {
+        emitters[k].pending = 0.0f;
+        if (emitters[k].rate < 0.0f)
+            Spawn(emitters[k], capacity - count, width, height, true);
+    }
+}
+
+template <typename KeyFn>
+void ParticleSystem::SortByKey(int n, int num_keys, KeyFn key, std::vector<int>& sorted, std::vector<int>& start, std::vector<int>& offsets)
+{
+    // Few big tasks (one histogram per task)
+    TaskScheduler* scheduler = TaskScheduler::Get();
+    int grain = n;
+    if (n >= PARALLEL_THRESHOLD)
+        grain = std::max(PARALLEL_GRAIN, (n + (int)scheduler->GetNumThreads()) / ((int)scheduler->GetNumThreads() + 1));
+    grain = std::max(grain, 1);
+    const int num_tasks = std::max((n + grain - 1) / grain, 1);
+
+    // Particles per task and key
+    offsets.assign((size_t)num_tasks * num_keys, 0);
+    scheduler->ParallelFor(0, n, grain, [&](int begin, int end) {
+        int* counts = &offsets[(size_t)(begin / grain) * num_keys];
+        for (int i = begin; i < end; ++i)
+            counts[key(i)]++;
+    });
+
+    // Turn the counts into write offsets (key major, so each key is contiguous)
+    start.resize(num_keys + 1);
+    int offset = 0;
+    for (int k = 0; k < num_keys; ++k)
+    {
+        start[k] = offset;
+        for (int t = 0; t < num_tasks; ++t)
+        {
+            int& slot = offsets[(size_t)t * num_keys + k];
+            int n = slot;
+            slot = offset;
+            offset += n;
+        }
+    }
+    start[num_keys] = offset;
+
+    sorted.resize(n);
+    scheduler->ParallelFor(0, n, grain, [&](int begin, int end) {
+        int* write = &offsets[(size_t)(begin / grain) * num_keys];
+        for (int i = begin; i < end; ++i)
+            sorted[write[key(i)]++] = i;
+    });
+}
+
+void ParticleSystem::BuildGrid(float cell_size, int width, int height)
+{
+    PROFILE_SCOPE("ParticleSystem::BuildGrid");
+
+    gridCellSize = std::max(cell_size, 1.0f);
+    gridCols = std::max((int)ceilf(width / gridCellSize), 1);
+    gridRows = std::max((int)ceilf(height / gridCellSize), 1);
+
+    const float inv = 1.0f / gridCellSize;
+    const int cols = gridCols, rows = gridRows;
+    auto cell_of = [=](int i) {
+        int cx = std::min(std::max((int)(posX[i] * inv), 0), cols - 1);
+        int cy = std::min(std::max((int)(posY[i] * inv), 0), rows - 1);
+        return cy * cols + cx;
+    };
+    SortByKey(count, cols * rows, cell_of, gridIndex, cellStart, gridOffsets);
+
+    // Positions in cell order
+    gridX.resize(count);
+    gridY.resize(count);
+    int grain = count < PARALLEL_THRESHOLD ? std::max(count, 1) : PARALLEL_GRAIN;
+    TaskScheduler::Get()->ParallelFor(0, count, grain, [&](int begin, int end) {
+        for (int k = begin; k < end; ++k)
+        {
+            gridX[k] = posX[gridIndex[k]];
+            gridY[k] = posY[gridIndex[k]];
+        }
+    });
+}
+
+void ParticleSystem::InteractRange(int begin, int end, float dt)
+{
+    // Particles pushing each other apart. Goes through the grid in cell order, so close queries read the same cells.
+    const float radius = interactionRadius;
+    const float k = interactionStrength * dt;
+    for (int s = begin; s < end; ++s)
     {
-        particles[i].inactive = false;
+        int i = gridIndex[s];
+        float ax = 0.0f, ay = 0.0f;
+        ForEachNeighbour(gridX[s], gridY[s], radius, [&](int j, float dx, float dy) {
+            float d2 = dx * dx + dy * dy;
+            if (j == i || d2 < 1e-6f)
+                return;
+            float d = sqrtf(d2);
+            float f = (1.0f - d / radius) / d;
+            ax -= dx * f;
+            ay -= dy * f;
+        });
+        velX[i] += ax * k;
+        velY[i] += ay * k;
+    }
+}
 
-        particles[i].ttl = 5.0f + frand01() * 5.0f;
+void ParticleSystem::UpdateRange(int begin, int end, const StepParams& p)
+{
+    float* __restrict px = posX;
+    float* __restrict py = posY;
+    float* __restrict ox = prevX;
+    float* __restrict oy = prevY;
+    float* __restrict vx = velX;
+    float* __restrict vy = velY;
+    float* __restrict life = ttl;
+    unsigned char* __restrict dead = deadMask.data();
+    const float dt = p.dt;
 
-        float vx = (frand01() * 2.0f - 1.0f) * 30.0f; // drift
-        float vy = 50.0f + frand01() * 150.0f;        // down speed
-        particles[i].velocity = Vector2(vx, vy);
+    // Attractors
+    for (size_t f = 0; f < forces.size(); ++f)
+    {
+        const ParticleForce& force = forces[f];
+        if (force.type != ParticleForce::ATTRACTOR)
+            continue;
 
-        unsigned char v = (unsigned char)(180 + frand01() * 75);
-        particles[i].color = Color(v, v, v);
+        const float cx = force.position.x, cy = force.position.y;
+        const float k = force.strength * dt;
+        const float inv_radius = force.radius > 0.0f ? 1.0f / force.radius : 0.0f;
+#pragma omp simd
+        for (int i = begin; i < end; ++i)
+        {
+            float dx = cx - px[i], dy = cy - py[i];
+            float d = sqrtf(dx * dx + dy * dy) + 1e-3f;
+            float s = k * std::max(1.0f - d * inv_radius, 0.0f) / d;
+            vx[i] += dx * s;
+            vy[i] += dy * s;
+        }
+    }
 
-        particles[i].ttl = 5.0f + frand01() * 5.0f;
+    // Gravity and wind, integrate and flag the dead/out of screen particles (no branches, vectorized)
+    const float ax = p.accX, ay = p.accY, drag = p.drag;
+    const float width = p.width, height = p.height;
+#pragma omp simd
+    for (int i = begin; i < end; ++i)
+    {
+        vx[i] += (ax - drag * vx[i]) * dt;
+        vy[i] += (ay - drag * vy[i]) * dt;
+        ox[i] = px[i];
+        oy[i] = py[i];
+        px[i] += vx[i] * dt;
+        py[i] += vy[i] * dt;
+        life[i] -= dt;
+        dead[i] = (life[i] <= 0.0f) | (py[i] >= height) | (py[i] < 0.0f) | (px[i] < 0.0f) | (px[i] >= width);
     }
 }
 
 void ParticleSystem::Update(float dt, int width, int height)
 {
-    // Update using dt (seconds)
-    for (int i = 0; i < MAX_PARTICLES; ++i)
+    PROFILE_SCOPE("ParticleSystem::Update");
+
+    if ((int)deadMask.size() < count)
+        deadMask.resize(capacity);
+
+    // Wind pulls the velocity towards the air velocity: sum(drag_i * (wind_i - v)) = sum(drag_i * wind_i) - sum(drag_i) * v
+    StepParams params = { dt, (float)width, (float)height, 0.0f, 0.0f, 0.0f };
+    for (size_t f = 0; f < forces.size(); ++f)
     {
-        if (particles[i].inactive)
-            continue;
+        const ParticleForce& force = forces[f];
+        if (force.type == ParticleForce::GRAVITY)
+        {
+            params.accX += force.vector.x;
+            params.accY += force.vector.y;
+        }
+        else if (force.type == ParticleForce::WIND)
+        {
+            params.accX += force.vector.x * force.strength;
+            params.accY += force.vector.y * force.strength;
+            params.drag += force.strength;
+        }
+    }
+
+    // Every task only writes the velocities of its own particles, positions are read from the grid copy
+    const int grain = count < PARALLEL_THRESHOLD ? std::max(count, 1) : PARALLEL_GRAIN;
+    if (interactionRadius > 0.0f)
+    {
+        BuildGrid(interactionRadius, width, height);
+        TaskScheduler::Get()->ParallelFor(0, count, grain, [&](int begin, int end) {
+            PROFILE_SCOPE("ParticleSystem::InteractRange");
+            InteractRange(begin, end, dt);
+        });
+    }
+
+    TaskScheduler::Get()->ParallelFor(0, count, grain, [&](int begin, int end) {
+        PROFILE_SCOPE("ParticleSystem::UpdateRange");
+        UpdateRange(begin, end, params);
+    });
 
-        particles[i].ttl -= dt;
-        particles[i].position = particles[i].position + particles[i].velocity * dt;
+    // Remove the flagged particles going backwards, so the moved (last) one has already been checked
+    for (int i = count - 1; i >= 0; --i)
+        if (deadMask[i])
+            Kill(i);
 
-        // Respawn if dead/out of screen
-        if (particles[i].ttl <= 0.0f ||
-            particles[i].position.y >= height ||
-            particles[i].position.x < 0 || particles[i].position.x >= width)
+    // Emit (emitters with a negative rate refill the system)
+    PROFILE_SCOPE("ParticleSystem::Emit");
+    for (size_t k = 0; k < emitters.size(); ++k)
+    {
+        ParticleEmitter& e = emitters[k];
+        int amount = capacity - count;
+        if (e.rate >= 0.0f)
         {
-            particles[i].position = Vector2(frand01() * width, 0.0f);
+            e.pending += e.rate * dt;
+            amount = (int)e.pending;
+            e.pending -= amount;
+        }
+        Spawn(e, amount, width, height, false);
+    }
+}
+
+void ParticleSystem::Render(Image* framebuffer, float alpha)
+{
+    PROFILE_SCOPE("ParticleSystem::Render");
 
-            float vx = (frand01() * 2.0f - 1.0f) * 30.0f;
-            float vy = 50.0f + frand01() * 150.0f;
-            particles[i].velocity = Vector2(vx, vy);
+    renderAlpha = std::min(std::max(alpha, 0.0f), 1.0f);
+    if (!doubleBuffered)
+    {
+        RenderView live = { posX, posY, prevX, prevY, color, count };
+        view = live;
+    }
+    RASTER_COUNT_PRIMITIVE(POINT, view.count);
+
+    if (blendMode != PIXEL)
+    {
+        RenderSplats(framebuffer);
+        return;
+    }
 
-            particles[i].ttl = 5.0f + frand01() * 5.0f;
+    if (view.count < PARALLEL_THRESHOLD)
+    {
+        // Draw each particle as a pixel (safe write)
+        for (int i = 0; i < view.count; ++i)
+            framebuffer->SetPixelSafeInt((int)DrawX(i), (int)DrawY(i), view.color[i]);
+        return;
+    }
+
+    // Split the framebuffer in horizontal bands and bin the particles by band,
+    // then each task draws whole bands so no two threads write the same rows
+    TaskScheduler* scheduler = TaskScheduler::Get();
+    const int height = (int)framebuffer->height;
+    const int num_bands = std::max(1, std::min(height, (int)(scheduler->GetNumThreads() + 1) * 4));
+    const int band_height = std::max(1, (height + num_bands - 1) / num_bands);
+
+    auto band_of = [=](int i) {
+        int band = (int)DrawY(i) / band_height;
+        return std::min(std::max(band, 0), num_bands - 1);
+    };
+    SortByKey(view.count, num_bands, band_of, binned, bandStart, binOffsets);
+
+    // Draw (particles outside the framebuffer are rejected by the safe write, so they never touch other bands)
+    scheduler->ParallelFor(0, num_bands, 1, [&](int first_band, int last_band) {
+        for (int k = bandStart[first_band]; k < bandStart[last_band]; ++k)
+        {
+            int i = binned[k];
+            framebuffer->SetPixelSafeInt((int)DrawX(i), (int)DrawY(i), view.color[i]);
+        }
+    });
+}
+
+void ParticleSystem::SetBlendMode(BlendMode mode, float radius, float opacity)
+{
+    blendMode = mode;
+    splatRadius = std::min(std::max(radius, 0.5f), (float)SPLAT_MAX_RADIUS);
+    splatOpacity = std::min(std::max(opacity, 0.0f), 1.0f);
+    if (mode != PIXEL)
+        BuildSplatKernels();
+}
+
+void ParticleSystem::BuildSplatKernels()
+{
+    // A kernel per sub-pixel position of the center, covering [floor(center) - r, floor(center) + r]
+    const int r = (int)ceilf(splatRadius);
+    splatSize = 2 * r + 1;
+    const int row = splatSize * 3;
+    splatKernels.resize((size_t)SPLAT_SUBPIXEL * SPLAT_SUBPIXEL * splatSize * row);
+
+    for (int sy = 0; sy < SPLAT_SUBPIXEL; ++sy)
+    for (int sx = 0; sx < SPLAT_SUBPIXEL; ++sx)
+    {
+        unsigned short* kernel = &splatKernels[(size_t)(sy * SPLAT_SUBPIXEL + sx) * splatSize * row];
+        float cx = (sx + 0.5f) / SPLAT_SUBPIXEL;
+        float cy = (sy + 0.5f) / SPLAT_SUBPIXEL;
+        for (int ky = 0; ky < splatSize; ++ky)
+        for (int kx = 0; kx < splatSize; ++kx)
+        {
+            // Pixel coverage approximated by the distance to the edge (anti-aliasing)
+            float dx = kx - r + 0.5f - cx;
+            float dy = ky - r + 0.5f - cy;
+            float coverage = std::min(std::max(splatRadius + 0.5f - sqrtf(dx * dx + dy * dy), 0.0f), 1.0f);
+            unsigned short w = (unsigned short)(coverage * splatOpacity * 256.0f + 0.5f);
+            for (int c = 0; c < 3; ++c)
+                kernel[ky * row + kx * 3 + c] = w;
         }
     }
 }
 
-void ParticleSystem::Render(Image* framebuffer)
+// Blend n bytes, w is the weight of each byte (0..256)
+static void BlendAdditive(unsigned char* __restrict dst, const unsigned char* __restrict src, const unsigned short* __restrict w, int n)
 {
-    // Draw each particle as a pixel (safe write)
-    for (int i = 0; i < MAX_PARTICLES; ++i)
+#pragma omp simd
+    for (int b = 0; b < n; ++b)
     {
-        if (particles[i].inactive)
-            continue;
+        int v = dst[b] + ((src[b] * w[b]) >> 8);
+        dst[b] = (unsigned char)(v < 255 ? v : 255);
+    }
+}
 
-        int x = (int)particles[i].position.x;
-        int y = (int)particles[i].position.y;
+static void BlendAlpha(unsigned char* __restrict dst, const unsigned char* __restrict src, const unsigned short* __restrict w, int n)
+{
+#pragma omp simd
+    for (int b = 0; b < n; ++b)
+    {
+        int d = dst[b];
+        dst[b] = (unsigned char)(d + (((src[b] - d) * w[b]) >> 8));
+    }
+}
 
-        framebuffer->SetPixelSafeInt(x, y, particles[i].color);
+void ParticleSystem::DrawSplat(Image* framebuffer, int i, int clip_y0, int clip_y1)
+{
+    const int r = splatSize / 2;
+    const float x = DrawX(i), y = DrawY(i);
+    const float fx = floorf(x), fy = floorf(y);
+    const int oy = (int)fy - r;
+    if (oy >= clip_y1 || oy + splatSize <= clip_y0)
+        return;
+
+    const int row = splatSize * 3;
+    const int sx = std::min((int)((x - fx) * SPLAT_SUBPIXEL), SPLAT_SUBPIXEL - 1);
+    const int sy = std::min((int)((y - fy) * SPLAT_SUBPIXEL), SPLAT_SUBPIXEL - 1);
+    const unsigned short* kernel = &splatKernels[(size_t)(sy * SPLAT_SUBPIXEL + sx) * splatSize * row];
+
+    // Clip the kernel to the framebuffer (and to the rows of the calling task)
+    const int ox = (int)fx - r;
+    const int x0 = std::max(ox, 0), x1 = std::min(ox + splatSize, (int)framebuffer->width);
+    const int y0 = std::max(oy, clip_y0), y1 = std::min(oy + splatSize, clip_y1);
+    if (x0 >= x1 || y0 >= y1)
+        return;
+    RASTER_COUNT_PIXELS((uint64_t)(x1 - x0) * (y1 - y0), 0);
+
+    // Particle color repeated for a whole kernel row
+    unsigned char src[(2 * SPLAT_MAX_RADIUS + 1) * 3];
+    const int n = (x1 - x0) * 3;
+    for (int b = 0; b < n; b += 3)
+    {
+        src[b] = view.color[i].r;
+        src[b + 1] = view.color[i].g;
+        src[b + 2] = view.color[i].b;
     }
+
+    for (int y = y0; y < y1; ++y)
+    {
+        unsigned char* dst = (unsigned char*)&framebuffer->pixels[y * framebuffer->width + x0];
+        const unsigned short* w = kernel + (y - oy) * row + (x0 - ox) * 3;
+        if (blendMode == ADDITIVE)
+            BlendAdditive(dst, src, w, n);
+        else
+            BlendAlpha(dst, src, w, n);
+    }
+}
+
+void ParticleSystem::RenderSplats(Image* framebuffer)
+{
+    PROFILE_SCOPE("ParticleSystem::RenderSplats");
+
+    // Bin the particles by tile so the splats of each tile are drawn together (they hit the same cache lines)
+    const int width = (int)framebuffer->width, height = (int)framebuffer->height;
+    const int tiles_x = std::max((width + SPLAT_TILE - 1) / SPLAT_TILE, 1);
+    const int tiles_y = std::max((height + SPLAT_TILE - 1) / SPLAT_TILE, 1);
+
+    auto tile_of = [=](int i) {
+        int tx = std::min(std::max((int)DrawX(i) / SPLAT_TILE, 0), tiles_x - 1);
+        int ty = std::min(std::max((int)DrawY(i) / SPLAT_TILE, 0), tiles_y - 1);
+        return ty * tiles_x + tx;
+    };
+    SortByKey(view.count, tiles_x * tiles_y, tile_of, binned, bandStart, binOffsets);
+
+    // Each task owns the rows of a row of tiles. Splats reach the tiles above and below,
+    // so it also draws the particles of the neighbour rows clipped to its own rows.
+    const int reach = (splatSize / 2 + SPLAT_TILE - 1) / SPLAT_TILE;
+    const int grain = view.count < PARALLEL_THRESHOLD ? tiles_y : 1;
+    TaskScheduler::Get()->ParallelFor(0, tiles_y, grain, [&](int first_row, int last_row) {
+        for (int ty = first_row; ty < last_row; ++ty)
+        {
+            const int clip_y0 = ty * SPLAT_TILE;
+            const int clip_y1 = std::min(clip_y0 + SPLAT_TILE, height);
+            const int ny0 = std::max(ty - reach, 0), ny1 = std::min(ty + reach, tiles_y - 1);
+            for (int tx = 0; tx < tiles_x; ++tx)
+                for (int ny = ny0; ny <= ny1; ++ny)
+                {
+                    int tile = ny * tiles_x + tx;
+                    for (int k = bandStart[tile]; k < bandStart[tile + 1]; ++k)
+                        DrawSplat(framebuffer, binned[k], clip_y0, clip_y1);
+                }
+        }
+    });
+}
+
+void ParticleSystem::SetDoubleBuffered(bool enabled)
+{
+    doubleBuffered = enabled;
+    if (enabled)
+        Publish();
+}
+
+void ParticleSystem::Publish()
+{
+    PROFILE_SCOPE("ParticleSystem::Publish");
+
+    if (!doubleBuffered)
+        return;
+
+    // Copy only what Render reads
+    publishedX.resize(count);
+    publishedY.resize(count);
+    publishedPrevX.resize(count);
+    publishedPrevY.resize(count);
+    publishedColor.resize(count);
+
+    const int grain = count < PARALLEL_THRESHOLD ? std::max(count, 1) : PARALLEL_GRAIN;
+    TaskScheduler::Get()->ParallelFor(0, count, grain, [&](int begin, int end) {
+        size_t n = end - begin;
+        memcpy(&publishedX[begin], posX + begin, n * sizeof(float));
+        memcpy(&publishedY[begin], posY + begin, n * sizeof(float));
+        memcpy(&publishedPrevX[begin], prevX + begin, n * sizeof(float));
+        memcpy(&publishedPrevY[begin], prevY + begin, n * sizeof(float));
+        memcpy((void*)&publishedColor[begin], color + begin, n * sizeof(Color));
+    });
+
+    RenderView published = { publishedX.data(), publishedY.data(), publishedPrevX.data(), publishedPrevY.data(), publishedColor.data(), count };
+    view = published;
 }
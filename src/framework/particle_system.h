@@ -1,25 +1,232 @@
 #pragma once
 #include "image.h"
+#include "rng.h"
+#include <vector>
+#include <algorithm>
+
+// Creates particles every frame (see ParticleSystem::AddEmitter)
+struct ParticleEmitter
+{
+    enum Shape { POINT, LINE, RECT, CIRCLE };
+    enum VelocityMode { BOX, CONE };
+
+    Shape shape = POINT;
+    Vector2 position;                   // POINT/CIRCLE: center, LINE: start, RECT: corner
+    Vector2 size;                       // LINE: offset to the end, RECT: width and height, CIRCLE: radius in x
+
+    float rate = 100.0f;                // Particles per second (< 0 keeps the system full)
+
+    VelocityMode velocity = CONE;
+    Vector2 velocityMin, velocityMax;   // BOX: uniform per axis (pixels per second)
+    float angle = 0.0f;                 // CONE: direction and half aperture (radians)
+    float spread = 3.14159265f;
+    float speedMin = 50.0f, speedMax = 100.0f;
+
+    float ttlMin = 1.0f, ttlMax = 2.0f; // Time to live (seconds)
+    Color colorMin = Color(255, 255, 255), colorMax = Color(255, 255, 255);
+
+    float pending = 0.0f;               // Fraction of particle left for the next frame
+};
+
+// Acceleration applied to every particle (see ParticleSystem::AddForce)
+struct ParticleForce
+{
+    enum Type { GRAVITY, WIND, ATTRACTOR };
+
+    Type type = GRAVITY;
+    Vector2 vector;                     // GRAVITY: acceleration, WIND: air velocity (pixels per second)
+    Vector2 position;                   // ATTRACTOR: center
+    float strength = 1.0f;              // WIND: drag (1/s), ATTRACTOR: acceleration at the center (< 0 repels)
+    float radius = 0.0f;                // ATTRACTOR: fades to 0 at this distance (0 = no limit)
+};
 
 class ParticleSystem
 {
-    // Max particles (fixed array for speed)
-    static const int MAX_PARTICLES = 200;
+public:
+    // How Render draws the particles
+    enum BlendMode
+    {
+        PIXEL,      // One pixel, overwritten (default)
+        ADDITIVE,   // Anti-aliased disc added to the framebuffer
+        ALPHA       // Anti-aliased disc blended over the framebuffer
+    };
+
+private:
+    // Default number of particles (see SetCapacity)
+    static const int DEFAULT_CAPACITY = 200;
+
+    // Splats: kernels for SPLAT_SUBPIXEL^2 sub-pixel positions, particles binned in SPLAT_TILE pixel tiles
+    static const int SPLAT_SUBPIXEL = 4;
+    static const int SPLAT_TILE = 32;
+    static const int SPLAT_MAX_RADIUS = 32;
+
+    // Below this many particles Update/Render run in the calling thread (not worth waking the workers)
+    static const int PARALLEL_THRESHOLD = 16384;
+    static const int PARALLEL_GRAIN = 8192;     // Particles per task
 
-    struct Particle
+    // Structure of arrays: each attribute lives in its own 64-byte aligned array so the update loops vectorize.
+    // Alive particles are always packed in [0, count), dead ones are removed by moving the last one into their slot.
+    float* posX = nullptr;      // Pixel position (float for smooth motion)
+    float* posY = nullptr;
+    float* prevX = nullptr;     // Position before the last Update (Render interpolates between both)
+    float* prevY = nullptr;
+    float* velX = nullptr;      // Pixels per second
+    float* velY = nullptr;
+    float* ttl = nullptr;       // Time to live (seconds)
+    Color* color = nullptr;
+
+    int count = 0;              // Alive particles
+    int capacity = 0;           // Allocated particles
+
+    float renderAlpha = 1.0f;   // Interpolation of the current Render
+
+    // What Render reads: the live arrays, or the copy made by Publish when double buffered
+    struct RenderView
     {
-        Vector2 position = Vector2();   // Pixel position (float for smooth motion)
-        Vector2 velocity = Vector2();   // Pixels per second
-        Color color = Color::WHITE;
+        const float* posX;
+        const float* posY;
+        const float* prevX;
+        const float* prevY;
+        const Color* color;
+        int count;
+    };
+    RenderView view = {};
+
+    bool doubleBuffered = false;
+    std::vector<float> publishedX, publishedY, publishedPrevX, publishedPrevY;
+    std::vector<Color> publishedColor;
+
+    // Every spawn batch uses its own random streams of the seed, so a run is reproducible
+    uint64_t seed = 1;
+    uint64_t spawnBatch = 0;
 
-        float ttl = 0.0f;               // Time to live (seconds)
-        bool inactive = true;           // Skip update/render if true
+    std::vector<ParticleEmitter> emitters;
+    std::vector<ParticleForce> forces;
+
+    float interactionRadius = 0.0f;
+    float interactionStrength = 0.0f;
+
+    // Uniform grid: particles sorted by cell, with a copy of their positions so neighbour scans read contiguous memory
+    float gridCellSize = 0.0f;
+    int gridCols = 0, gridRows = 0;
+    std::vector<int> cellStart;                 // First sorted particle of each cell (cols * rows + 1)
+    std::vector<int> gridIndex;                 // Particle index of each sorted particle
+    std::vector<float> gridX, gridY;
+    std::vector<int> gridOffsets;               // Scratch of the sort (Render has its own, they can run at the same time)
+
+    BlendMode blendMode = PIXEL;
+    float splatRadius = 1.0f;
+    float splatOpacity = 1.0f;
+    int splatSize = 0;                          // Kernel width and height in pixels
+    std::vector<unsigned short> splatKernels;   // Weights (0..256) per byte (3 per pixel) of every sub-pixel kernel
+
+    // Scratch kept between frames
+    std::vector<unsigned char> deadMask;        // Filled by the parallel update, compacted serially
+    std::vector<int> binned;                    // Particle indices sorted by framebuffer band/tile
+    std::vector<int> binOffsets;                // Scratch of the Render sorts
+    std::vector<int> bandStart;                 // First binned index of each band/tile
+
+    // Constant part of the forces, gathered once per frame
+    struct StepParams
+    {
+        float dt, width, height;
+        float accX, accY;       // Gravity + wind
+        float drag;             // Sum of the wind drags
     };
 
-    Particle particles[MAX_PARTICLES];
+    void Allocate(int capacity);
+    void Free();
+    void Kill(int i);                             // Swap-and-pop
+    void Spawn(const ParticleEmitter& emitter, int amount, int width, int height, bool anywhere);
+    void SpawnRange(Rng& rng, const ParticleEmitter& emitter, int begin, int end, int width, int height, bool anywhere);
+    void InteractRange(int begin, int end, float dt);     // Range of the grid order
+    void UpdateRange(int begin, int end, const StepParams& params);
+    // Position drawn by Render
+    inline float DrawX(int i) const { return renderAlpha >= 1.0f ? view.posX[i] : view.prevX[i] + (view.posX[i] - view.prevX[i]) * renderAlpha; }
+    inline float DrawY(int i) const { return renderAlpha >= 1.0f ? view.posY[i] : view.prevY[i] + (view.posY[i] - view.prevY[i]) * renderAlpha; }
+
+    void BuildSplatKernels();
+    void RenderSplats(Image* framebuffer);
+    void DrawSplat(Image* framebuffer, int i, int clip_y0, int clip_y1);
+
+    // Counting sort of the indices [0, n) (on the worker pool), sorted[start[k], start[k+1]) have key k
+    template <typename KeyFn>
+    void SortByKey(int n, int num_keys, KeyFn key, std::vector<int>& sorted, std::vector<int>& start, std::vector<int>& offsets);
 
 public:
+    ParticleSystem();
+    ~ParticleSystem();
+    ParticleSystem(const ParticleSystem&) = delete;
+    ParticleSystem& operator = (const ParticleSystem&) = delete;
+
+    // Max particles alive at once (can be changed at runtime, alive particles are kept)
+    void SetCapacity(int capacity);
+    int GetCapacity() const { return capacity; }
+    int GetCount() const { return count; }
+
+    // Same seed, sizes and time steps give the same particles (call before Init)
+    void SetSeed(uint64_t seed) { this->seed = seed; spawnBatch = 0; }
+
+    // Emitters and forces (Init adds the starfield emitter when there is none)
+    int AddEmitter(const ParticleEmitter& emitter) { emitters.push_back(emitter); return (int)emitters.size() - 1; }
+    ParticleEmitter& GetEmitter(int i) { return emitters[i]; }
+    int GetNumEmitters() const { return (int)emitters.size(); }
+    void ClearEmitters() { emitters.clear(); }
+
+    int AddForce(const ParticleForce& force) { forces.push_back(force); return (int)forces.size() - 1; }
+    ParticleForce& GetForce(int i) { return forces[i]; }
+    int GetNumForces() const { return (int)forces.size(); }
+    void ClearForces() { forces.clear(); }
+
+    // Particles closer than radius push each other apart (uses the grid, radius 0 disables it)
+    void SetInteraction(float radius, float strength) { interactionRadius = radius; interactionStrength = strength; }
+
+    // Draw particles as discs of the given radius (pixels) and opacity (0..1), or as single pixels (PIXEL)
+    void SetBlendMode(BlendMode mode, float radius = 1.0f, float opacity = 1.0f);
+    BlendMode GetBlendMode() const { return blendMode; }
+
+    // Stars falling from the top of the screen (the default emitter), as wide as the screen
+    static ParticleEmitter Starfield(int width);
+
+    // Sorts the particles in a uniform grid, rebuilt in O(n). Update does it when interactions are enabled.
+    void BuildGrid(float cell_size, int width, int height);
+
+    // Calls f(particle index, dx, dy) for every particle of the last built grid within radius of (x,y),
+    // (dx,dy) goes from (x,y) to the particle. Radius should not be bigger than the cell size.
+    template <typename F>
+    void ForEachNeighbour(float x, float y, float radius, F f) const
+    {
+        if (cellStart.empty())
+            return;
+
+        const float inv = 1.0f / gridCellSize;
+        int x0 = std::max((int)((x - radius) * inv), 0), x1 = std::min((int)((x + radius) * inv), gridCols - 1);
+        int y0 = std::max((int)((y - radius) * inv), 0), y1 = std::min((int)((y + radius) * inv), gridRows - 1);
+        if (x0 > x1 || y0 > y1)
+            return;
+        const float r2 = radius * radius;
+
+        // The cells of a row are contiguous in the sorted arrays
+        for (int cy = y0; cy <= y1; ++cy)
+        {
+            int end = cellStart[cy * gridCols + x1 + 1];
+            for (int k = cellStart[cy * gridCols + x0]; k < end; ++k)
+            {
+                float dx = gridX[k] - x, dy = gridY[k] - y;
+                if (dx * dx + dy * dy <= r2)
+                    f(gridIndex[k], dx, dy);
+            }
+        }
+    }
+
     void Init(int width, int height);
     void Update(float dt, int width, int height); // dt in seconds
-    void Render(Image* framebuffer);
+
+    // Double buffered: Render draws the particles copied by the last Publish, so Update can run in another thread
+    // at the same time. Publish must be called while no Update is running.
+    void SetDoubleBuffered(bool enabled);
+    void Publish();
+
+    // alpha: fraction of the last step to draw (0 = position before the last Update, 1 = current position)
+    void Render(Image* framebuffer, float alpha = 1.0f);
 };
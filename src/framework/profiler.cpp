@@ -0,0 +1,438 @@
+#include "profiler.h"
+#include "image.h"
+#include "utils.h"
+#include "frame_arena.h"
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include <iostream>
+
+std::atomic<bool> Profiler::enabled(false);
+
+const int Profiler::RING_SIZE;
+const size_t Profiler::MAX_TRACE_EVENTS;
+const int Profiler::FRAME_HISTORY;
+const int64_t Profiler::HUD_REFRESH;
+
+Profiler::Profiler()
+{
+	frame_start = refresh_start = Now();
+}
+
+Profiler::~Profiler()
+{
+}
+
+Profiler* Profiler::Get()
+{
+	static Profiler profiler;
+	return &profiler;
+}
+
+int64_t Profiler::Now()
+{
+	static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+void Profiler::SetEnabled(bool enable)
+{
+	enabled = enable;
+}
+
+Profiler::ThreadBuffer* Profiler::GetThreadBuffer()
+{
+	static thread_local ThreadBuffer* buffer = nullptr;
+	if (buffer)
+		return buffer;
+
+	std::lock_guard<std::mutex> lock(threads_mutex);
+	threads.push_back(std::unique_ptr<ThreadBuffer>(new ThreadBuffer()));
+	buffer = threads.back().get();
+	buffer->ring.resize(RING_SIZE);
+	buffer->head = 0;
+	buffer->index = (int)threads.size() - 1;
+	buffer->name = "Thread " + std::to_string(buffer->index);
+	return buffer;
+}
+
+void Profiler::SetThreadName(const char* name)
+{
+	ThreadBuffer* buffer = GetThreadBuffer();
+	std::lock_guard<std::mutex> lock(threads_mutex);
+	buffer->name = name;
+}
+
+void ProfileScope::Begin()
+{
+	buffer = Profiler::Get()->GetThreadBuffer();
+	buffer->depth++;
+	start = Profiler::Now();
+}
+
+void ProfileScope::End()
+{
+	int64_t end = Profiler::Now();
+	buffer->depth--;
+
+	Profiler::Event event = { name, start, end, buffer->depth, buffer->index };
+	uint64_t head = buffer->head.load(std::memory_order_relaxed);
+	buffer->ring[head & (Profiler::RING_SIZE - 1)] = event;
+	buffer->head.store(head + 1, std::memory_order_release);
+}
+
+void Profiler::Collect(ThreadBuffer& buffer)
+{
+	// Events older than the ring were overwritten
+	uint64_t head = buffer.head.load(std::memory_order_acquire);
+	uint64_t tail = std::max(buffer.tail, head > (uint64_t)RING_SIZE ? head - RING_SIZE : 0);
+
+	size_t first = frame_events.size();
+	for (uint64_t i = tail; i < head; ++i)
+		frame_events.push_back(buffer.ring[i & (RING_SIZE - 1)]);
+
+	// The thread kept recording while we copied: drop the events it may have overwritten meanwhile
+	uint64_t written = buffer.head.load(std::memory_order_acquire);
+	if (written > (uint64_t)RING_SIZE && written - RING_SIZE > tail)
+	{
+		size_t lost = (size_t)std::min<uint64_t>(written - RING_SIZE - tail, head - tail);
+		frame_events.erase(frame_events.begin() + first, frame_events.begin() + first + lost);
+	}
+
+	buffer.tail = head;
+}
+
+void Profiler::BeginFrame()
+{
+	frame_start = Now();
+}
+
+void Profiler::EndFrame()
+{
+	const int64_t now = Now();
+	const int64_t frame_time = now - frame_start;
+	frame_history[frame_index++ % FRAME_HISTORY] = frame_time / 1e6f;
+
+	frame_events.clear();
+	{
+		std::lock_guard<std::mutex> lock(threads_mutex);
+		for (size_t i = 0; i < threads.size(); ++i)
+			Collect(*threads[i]);
+		refresh_threads.resize(threads.size(), 0);
+	}
+
+	// Parents end after their children, sort by start to get the call order
+	std::sort(frame_events.begin(), frame_events.end(), [](const Event& a, const Event& b)
+	{
+		return a.thread != b.thread ? a.thread < b.thread : a.start < b.start;
+	});
+
+	if (IsEnabled())
+	{
+		trace_events.insert(trace_events.end(), frame_events.begin(), frame_events.end());
+		if (trace_events.size() > MAX_TRACE_EVENTS)
+			trace_events.erase(trace_events.begin(), trace_events.begin() + (trace_events.size() - MAX_TRACE_EVENTS));
+	}
+
+	// HUD: scopes of the main thread (the one running the frames) and busy time of every thread
+	const int main_thread = GetThreadBuffer()->index;
+	for (size_t i = 0; i < frame_events.size(); ++i)
+	{
+		const Event& e = frame_events[i];
+		if (e.depth == 0)
+			refresh_threads[e.thread] += e.end - e.start;
+		if (e.thread != main_thread)
+			continue;
+
+		size_t s = 0;
+		while (s < refresh_scopes.size() && (refresh_scopes[s].depth != e.depth || strcmp(refresh_scopes[s].name, e.name) != 0))
+			++s;
+		if (s == refresh_scopes.size())
+		{
+			ScopeStat stat = { e.name, e.depth, 0 };
+			refresh_scopes.push_back(stat);
+		}
+		refresh_scopes[s].total += e.end - e.start;
+	}
+
+#ifdef CG_RASTER_STATS
+	RasterStats::EndFrame();
+	const RasterStats::Frame& raster = RasterStats::GetLastFrame();
+	refresh_raster.pixels_written += raster.pixels_written;
+	refresh_raster.pixels_rejected += raster.pixels_rejected;
+	for (int p = 0; p < RasterStats::NUM_PRIMITIVES; ++p)
+		refresh_raster.primitives[p] += raster.primitives[p];
+#endif
+
+#ifdef CG_ALLOC_STATS
+	AllocStats::EndFrame();
+	const AllocStats::Frame& alloc = AllocStats::GetLastFrame();
+	refresh_alloc.allocations += alloc.allocations;
+	refresh_alloc.frees += alloc.frees;
+	refresh_alloc.bytes += alloc.bytes;
+#endif
+	refresh_arena_peak = std::max(refresh_arena_peak, FrameArena::Get()->GetPeak());
+
+	refresh_frames++;
+	refresh_frame_time += frame_time;
+	if (now - refresh_start < HUD_REFRESH)
+		return;
+
+	// New averages for the HUD
+	fps = refresh_frames * 1e9f / (float)(now - refresh_start);
+	frame_ms = refresh_frame_time / 1e6f / refresh_frames;
+
+	hud_scopes = refresh_scopes;
+	for (size_t i = 0; i < hud_scopes.size(); ++i)
+		hud_scopes[i].total /= refresh_frames;
+
+	hud_threads.resize(refresh_threads.size());
+	for (size_t i = 0; i < refresh_threads.size(); ++i)
+		hud_threads[i] = refresh_threads[i] / 1e6f / refresh_frames;
+
+	hud_raster.pixels_written = refresh_raster.pixels_written / refresh_frames;
+	hud_raster.pixels_rejected = refresh_raster.pixels_rejected / refresh_frames;
+	for (int p = 0; p < RasterStats::NUM_PRIMITIVES; ++p)
+		hud_raster.primitives[p] = refresh_raster.primitives[p] / refresh_frames;
+	refresh_raster = RasterStats::Frame();
+
+	hud_alloc.allocations = refresh_alloc.allocations / refresh_frames;
+	hud_alloc.frees = refresh_alloc.frees / refresh_frames;
+	hud_alloc.bytes = refresh_alloc.bytes / refresh_frames;
+	refresh_alloc = AllocStats::Frame();
+	hud_arena_peak = refresh_arena_peak;
+	refresh_arena_peak = 0;
+
+	refresh_start = now;
+	refresh_frames = 0;
+	refresh_frame_time = 0;
+	refresh_scopes.clear();
+	std::fill(refresh_threads.begin(), refresh_threads.end(), 0);
+}
+
+// Writes str as a JSON string
+static void writeJSONString(FILE* file, const std::string& str)
+{
+	fputc('"', file);
+	for (size_t i = 0; i < str.size(); ++i)
+	{
+		char c = str[i];
+		if (c == '"' || c == '\\')
+			fputc('\\', file);
+		if ((unsigned char)c >= 32)
+			fputc(c, file);
+	}
+	fputc('"', file);
+}
+
+bool Profiler::SaveTrace(const char* filename) const
+{
+	std::string fullPath = absResPath(filename);
+	FILE* file = fopen(fullPath.c_str(), "wb");
+	if (file == NULL)
+	{
+		std::cerr << "--- Failed to save file: " << fullPath.c_str() << std::endl;
+		return false;
+	}
+
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	{
+		std::lock_guard<std::mutex> lock(threads_mutex);
+		for (size_t i = 0; i < threads.size(); ++i)
+		{
+			fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", threads[i]->index);
+			writeJSONString(file, threads[i]->name);
+			fprintf(file, "}},\n");
+		}
+	}
+
+	// Complete events, times in microseconds
+	for (size_t i = 0; i < trace_events.size(); ++i)
+	{
+		const Event& e = trace_events[i];
+		fprintf(file, "{\"name\":");
+		writeJSONString(file, e.name);
+		fprintf(file, ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}%s\n",
+			e.thread, e.start / 1000.0, (e.end - e.start) / 1000.0, i + 1 < trace_events.size() ? "," : "");
+	}
+	fprintf(file, "]}\n");
+
+	bool ok = ferror(file) == 0;
+	fclose(file);
+	if (!ok)
+	{
+		std::cerr << "--- Failed to save file: " << fullPath.c_str() << std::endl;
+		return false;
+	}
+
+	std::cout << "+++ File saved: " << fullPath.c_str() << std::endl;
+	return true;
+}
+
+// ---- HUD ----
+
+// 3x5 font for the characters 32 to 95 (lowercase is drawn uppercase). Rows top to bottom, 3 bits per row, left bit first.
+static const unsigned short FONT_GLYPHS[64] = {
+	0x0000, 0x2482, 0x5A00, 0x5F7D, 0x3C9E, 0x52A5, 0x2AAB, 0x2400,
+	0x1491, 0x4494, 0x0AA8, 0x05D0, 0x0014, 0x01C0, 0x0002, 0x12A4,
+	0x7B6F, 0x2C97, 0x73E7, 0x73CF, 0x5BC9, 0x79CF, 0x79EF, 0x7252,
+	0x7BEF, 0x7BCF, 0x0410, 0x0414, 0x1511, 0x0E38, 0x4454, 0x72C2,
+	0x7BE7, 0x2BED, 0x6BAE, 0x3923, 0x6B6E, 0x79A7, 0x79A4, 0x396B,
+	0x5BED, 0x7497, 0x126A, 0x5BAD, 0x4927, 0x5FED, 0x6B6D, 0x2B6A,
+	0x6BA4, 0x2B73, 0x6BAD, 0x388E, 0x7492, 0x5B6F, 0x5B6A, 0x5BFD,
+	0x5AAD, 0x5A92, 0x72A7, 0x3493, 0x4889, 0x6496, 0x2A00, 0x0007,
+};
+
+static const int FONT_SCALE = 2;
+static const int CHAR_ADVANCE = 4 * FONT_SCALE;
+static const int LINE_HEIGHT = 7 * FONT_SCALE;
+
+static void fillRect(Image& image, int x, int y, int w, int h, const Color& c)
+{
+	int x0 = std::max(x, 0), x1 = std::min(x + w, (int)image.width);
+	int y0 = std::max(y, 0), y1 = std::min(y + h, (int)image.height);
+	for (int py = y0; py < y1; ++py)
+		for (int px = x0; px < x1; ++px)
+			image.pixels[py * image.width + px] = c;
+}
+
+// top: row of the top of the characters (y grows upwards)
+static void drawText(Image& image, int x, int top, const char* text, const Color& c)
+{
+	for (; *text; ++text, x += CHAR_ADVANCE)
+	{
+		int ch = toupper((unsigned char)*text);
+		unsigned short glyph = FONT_GLYPHS[(ch >= 32 && ch < 96) ? ch - 32 : '?' - 32];
+		for (int row = 0; row < 5; ++row)
+			for (int col = 0; col < 3; ++col)
+				if (glyph & (1 << (14 - row * 3 - col)))
+					fillRect(image, x + col * FONT_SCALE, top - (row + 1) * FONT_SCALE, FONT_SCALE, FONT_SCALE, c);
+	}
+}
+
+void Profiler::DrawHUD(Image& framebuffer)
+{
+	const int GRAPH_HEIGHT = 64;
+	const float GRAPH_MAX_MS = 100.0f / 3.0f;   // Top of the graph (30 FPS)
+	const int MAX_SCOPES = 16;
+	const int width = FRAME_HISTORY * 2 + 24 + 100;
+
+	int num_scopes = std::min((int)hud_scopes.size(), MAX_SCOPES);
+	int num_lines = num_scopes + (int)hud_threads.size() + (IsEnabled() ? 0 : 1);
+#ifdef CG_RASTER_STATS
+	num_lines += 2;
+#endif
+#ifdef CG_ALLOC_STATS
+	num_lines += 1;
+#endif
+	int height = 6 + LINE_HEIGHT + GRAPH_HEIGHT + 6 + num_lines * LINE_HEIGHT + 6;
+
+	// Keep the pixels below the HUD (clipped to the framebuffer)
+	hud_x = 4;
+	hud_y = std::max((int)framebuffer.height - 4 - height, 0);
+	int w = std::max(std::min(width, (int)framebuffer.width - hud_x), 0);
+	int h = std::min(height, (int)framebuffer.height - hud_y);
+	if (w <= 0 || h <= 0)
+		return;
+	if (!hud_backup)
+		hud_backup.reset(new Image());
+	if (hud_backup->width != (unsigned int)w || hud_backup->height != (unsigned int)h)
+		*hud_backup = Image(w, h);
+	for (int y = 0; y < h; ++y)
+		memcpy(&hud_backup->pixels[y * w], &framebuffer.pixels[(hud_y + y) * framebuffer.width + hud_x], w * sizeof(Color));
+
+	const Color text_color(230, 230, 230);
+	const Color dim_color(150, 150, 150);
+	fillRect(framebuffer, hud_x, hud_y, w, h, Color(16, 16, 24));
+
+	char line[128];
+	int top = hud_y + height - 6;
+	snprintf(line, sizeof(line), "FPS %.1f  %.2f MS", fps, frame_ms);
+	drawText(framebuffer, hud_x + 6, top, line, text_color);
+	top -= LINE_HEIGHT;
+
+	// Frame times, newest on the right (green below 60 FPS, yellow below 30 FPS, red above)
+	int graph_y = top - GRAPH_HEIGHT;
+	fillRect(framebuffer, hud_x + 6, graph_y, FRAME_HISTORY * 2, GRAPH_HEIGHT, Color(32, 32, 44));
+	for (int i = 0; i < FRAME_HISTORY; ++i)
+	{
+		float ms = frame_history[(frame_index + i) % FRAME_HISTORY];
+		int bar = std::min((int)(ms / GRAPH_MAX_MS * GRAPH_HEIGHT), GRAPH_HEIGHT);
+		Color c = ms <= 1000.0f / 60.0f + 0.5f ? Color(60, 200, 90) : (ms <= GRAPH_MAX_MS + 0.5f ? Color(230, 200, 60) : Color(230, 70, 60));
+		fillRect(framebuffer, hud_x + 6 + i * 2, graph_y, 2, bar, c);
+	}
+	fillRect(framebuffer, hud_x + 6, graph_y + (int)(GRAPH_HEIGHT / 2.0f), FRAME_HISTORY * 2, 1, dim_color);
+	top = graph_y - 6;
+
+#ifdef CG_RASTER_STATS
+	// Pixels and primitives per frame (overdraw: writes per framebuffer pixel)
+	snprintf(line, sizeof(line), "PIXELS %.2fM  CLIPPED %.2fM  OVERDRAW %.2fX", hud_raster.pixels_written / 1e6,
+		hud_raster.pixels_rejected / 1e6, hud_raster.GetOverdraw(framebuffer.width, framebuffer.height));
+	drawText(framebuffer, hud_x + 6, top, line, text_color);
+	top -= LINE_HEIGHT;
+	snprintf(line, sizeof(line), "PT %llu LN %llu RC %llu TRI %llu IMG %llu",
+		(unsigned long long)hud_raster.primitives[RasterStats::POINT], (unsigned long long)hud_raster.primitives[RasterStats::LINE],
+		(unsigned long long)hud_raster.primitives[RasterStats::RECT], (unsigned long long)hud_raster.primitives[RasterStats::TRIANGLE],
+		(unsigned long long)hud_raster.primitives[RasterStats::IMAGE]);
+	drawText(framebuffer, hud_x + 6, top, line, dim_color);
+	top -= LINE_HEIGHT;
+#endif
+
+#ifdef CG_ALLOC_STATS
+	// Heap allocations per frame (steady state should be 0) and most scratch memory used by a frame
+	snprintf(line, sizeof(line), "ALLOCS %llu  %.1f KB  ARENA %.1f KB", (unsigned long long)hud_alloc.allocations,
+		hud_alloc.bytes / 1024.0, hud_arena_peak / 1024.0);
+	drawText(framebuffer, hud_x + 6, top, line, hud_alloc.allocations ? Color(230, 200, 60) : text_color);
+	top -= LINE_HEIGHT;
+#endif
+
+	if (!IsEnabled())
+	{
+		drawText(framebuffer, hud_x + 6, top, "SCOPES OFF", dim_color);
+		top -= LINE_HEIGHT;
+	}
+
+	// Time per scope of the main thread (average per frame), bar relative to the frame time
+	const int value_x = hud_x + 6 + FRAME_HISTORY * 2 - 9 * CHAR_ADVANCE;
+	const int bar_x = hud_x + 6 + FRAME_HISTORY * 2 + 6;
+	for (int i = 0; i < num_scopes; ++i)
+	{
+		const ScopeStat& s = hud_scopes[i];
+		float ms = s.total / 1e6f;
+		int indent = std::min(s.depth, 6) * CHAR_ADVANCE;
+		int max_chars = std::max((value_x - (hud_x + 6 + indent)) / CHAR_ADVANCE - 1, 0);
+		snprintf(line, sizeof(line), "%.*s", max_chars, s.name);
+		drawText(framebuffer, hud_x + 6 + indent, top, line, s.depth == 0 ? text_color : dim_color);
+		snprintf(line, sizeof(line), "%7.2f", ms);
+		drawText(framebuffer, value_x, top, line, text_color);
+		int bar = frame_ms > 0.0f ? std::min((int)(ms / frame_ms * 100.0f), 100) : 0;
+		fillRect(framebuffer, bar_x, top - 5 * FONT_SCALE, bar, 5 * FONT_SCALE, Color(80, 140, 230));
+		top -= LINE_HEIGHT;
+	}
+
+	// Busy time of the threads (sum of their outer scopes)
+	std::lock_guard<std::mutex> lock(threads_mutex);
+	for (size_t i = 0; i < hud_threads.size() && i < threads.size(); ++i)
+	{
+		snprintf(line, sizeof(line), "%s", threads[i]->name.c_str());
+		drawText(framebuffer, hud_x + 6, top, line, dim_color);
+		snprintf(line, sizeof(line), "%7.2f", hud_threads[i]);
+		drawText(framebuffer, value_x, top, line, dim_color);
+		top -= LINE_HEIGHT;
+	}
+}
+
+void Profiler::EraseHUD(Image& framebuffer)
+{
+	if (!hud_backup || !hud_backup->pixels)
+		return;
+
+	int w = std::min((int)hud_backup->width, (int)framebuffer.width - hud_x);
+	int h = std::min((int)hud_backup->height, (int)framebuffer.height - hud_y);
+	if (w <= 0)
+		return;
+	for (int y = 0; y < h; ++y)
+		memcpy(&framebuffer.pixels[(hud_y + y) * framebuffer.width + hud_x], &hud_backup->pixels[y * hud_backup->width], w * sizeof(Color));
+}
@@ -0,0 +1,165 @@
+/*
+	+ Frame profiler: PROFILE_SCOPE("name") times the rest of the block. Scopes can be nested and used from any thread,
+	  each thread records into its own ring buffer. The main loop collects them once per frame (EndFrame).
+	+ Compile-time switch: without CG_PROFILER the macro compiles to nothing. Runtime switch: SetEnabled (off by default,
+	  a disabled scope only reads a flag). Frame times and FPS are always measured.
+	+ The results can be drawn on the framebuffer (DrawHUD) or saved as a Chrome trace (chrome://tracing, Perfetto).
+	+ With CG_RASTER_STATS the HUD also shows the pixels and primitives drawn per frame (see raster_stats.h),
+	  with CG_ALLOC_STATS the heap allocations per frame (see alloc_stats.h).
+*/
+
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <stdint.h>
+#include "raster_stats.h"
+#include "alloc_stats.h"
+
+class Image;
+
+class Profiler
+{
+public:
+	// A timed scope (times in nanoseconds since the profiler was created)
+	struct Event
+	{
+		const char* name;   // Must outlive the profiler (string literal)
+		int64_t start;
+		int64_t end;
+		int depth;          // Nesting level in its thread
+		int thread;         // Index of the thread (see SetThreadName)
+	};
+
+	static Profiler* Get();
+
+	static bool IsEnabled() { return enabled.load(std::memory_order_relaxed); }
+	void SetEnabled(bool enable);
+
+	// Nanoseconds since the profiler was created
+	static int64_t Now();
+
+	// Name of the calling thread in the HUD and the trace
+	void SetThreadName(const char* name);
+
+	// Frame boundaries (main loop). EndFrame collects the scopes recorded by every thread since the last frame
+	// (and ends the frame of the raster and allocation statistics).
+	void BeginFrame();
+	void EndFrame();
+
+	float GetFPS() const { return fps; }
+	float GetFrameTime() const { return frame_ms; }    // Milliseconds, averaged over the last HUD refresh
+	const std::vector<Event>& GetFrameEvents() const { return frame_events; }
+
+	// Writes the last recorded scopes (up to MAX_TRACE_EVENTS) in the Chrome trace event format
+	bool SaveTrace(const char* filename) const;
+
+	// HUD: frame time graph and time per scope, drawn in the top left corner of the framebuffer.
+	// DrawHUD keeps the pixels it covers so EraseHUD can restore them (the framebuffer can be a canvas).
+	void SetHUDVisible(bool visible) { hud_visible = visible; }
+	bool IsHUDVisible() const { return hud_visible; }
+	void DrawHUD(Image& framebuffer);
+	void EraseHUD(Image& framebuffer);
+
+private:
+	static const int RING_SIZE = 1 << 14;           // Scopes per thread between two frames
+	static const size_t MAX_TRACE_EVENTS = 1 << 18;
+	static const int FRAME_HISTORY = 128;
+	static const int64_t HUD_REFRESH = 500000000;   // ns
+
+	// Written only by its thread, read by EndFrame
+	struct ThreadBuffer
+	{
+		std::vector<Event> ring;
+		std::atomic<uint64_t> head;     // Events written
+		uint64_t tail = 0;              // Events collected
+		int depth = 0;
+		int index = 0;
+		std::string name;
+	};
+
+	// Time of a scope of the main thread in the HUD
+	struct ScopeStat
+	{
+		const char* name;
+		int depth;
+		int64_t total;
+	};
+
+	static std::atomic<bool> enabled;
+
+	mutable std::mutex threads_mutex;
+	std::vector<std::unique_ptr<ThreadBuffer>> threads;     // Never removed (threads can end before EndFrame)
+
+	std::vector<Event> frame_events;
+	std::deque<Event> trace_events;
+
+	int64_t frame_start = 0;
+	float frame_history[FRAME_HISTORY] = {};                // Milliseconds
+	int frame_index = 0;
+
+	// HUD values, averaged between refreshes
+	int64_t refresh_start = 0;
+	int refresh_frames = 0;
+	int64_t refresh_frame_time = 0;
+	std::vector<ScopeStat> refresh_scopes;
+	std::vector<int64_t> refresh_threads;                   // Busy time of every thread
+	float fps = 0.0f, frame_ms = 0.0f;
+	RasterStats::Frame refresh_raster;
+	AllocStats::Frame refresh_alloc;
+	size_t refresh_arena_peak = 0;
+	std::vector<ScopeStat> hud_scopes;
+	std::vector<float> hud_threads;                         // Milliseconds per frame
+	RasterStats::Frame hud_raster;                          // Per frame
+	AllocStats::Frame hud_alloc;                            // Per frame
+	size_t hud_arena_peak = 0;                              // Bytes of the frame arena of the main thread
+
+	bool hud_visible = false;
+	int hud_x = 0, hud_y = 0;
+	std::unique_ptr<Image> hud_backup;
+
+	Profiler();
+	~Profiler();
+
+	ThreadBuffer* GetThreadBuffer();
+	void Collect(ThreadBuffer& buffer);
+
+	friend class ProfileScope;
+};
+
+// Records the time from its construction to its destruction (use PROFILE_SCOPE)
+class ProfileScope
+{
+public:
+	explicit ProfileScope(const char* name) : name(name)
+	{
+		if (Profiler::IsEnabled())
+			Begin();
+	}
+	~ProfileScope()
+	{
+		if (buffer)
+			End();
+	}
+
+private:
+	const char* name;
+	int64_t start = 0;
+	Profiler::ThreadBuffer* buffer = nullptr;
+
+	void Begin();
+	void End();
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+#ifdef CG_PROFILER
+	#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(name)
+#else
+	#define PROFILE_SCOPE(name)
+#endif
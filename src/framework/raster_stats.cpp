@@ -0,0 +1,74 @@
+#include "raster_stats.h"
+#include <mutex>
+
+static std::mutex s_mutex;
+static RasterStats::Frame s_last_frame;
+static RasterStats::Frame s_total;
+
+float RasterStats::Frame::GetOverdraw(unsigned int width, unsigned int height) const
+{
+	return width && height ? pixels_written / (float)((uint64_t)width * height) : 0.0f;
+}
+
+const char* RasterStats::GetPrimitiveName(Primitive primitive)
+{
+	static const char* names[NUM_PRIMITIVES] = { "Points", "Lines", "Rects", "Triangles", "Images" };
+	return primitive >= 0 && primitive < NUM_PRIMITIVES ? names[primitive] : "";
+}
+
+RasterStats::Counters* RasterStats::Register()
+{
+	Counters* counters = new Counters();
+	for (int i = 0; i < NUM_COUNTERS; ++i)
+	{
+		counters->values[i] = 0;
+		counters->collected[i] = 0;
+	}
+
+	std::lock_guard<std::mutex> lock(s_mutex);
+	GetThreads().push_back(std::unique_ptr<Counters>(counters));
+	return counters;
+}
+
+void RasterStats::EndFrame()
+{
+	// The counters only grow: the frame is what was added since the last collect
+	uint64_t frame[NUM_COUNTERS] = {};
+	{
+		std::lock_guard<std::mutex> lock(s_mutex);
+		std::vector<std::unique_ptr<Counters>>& threads = GetThreads();
+		for (size_t t = 0; t < threads.size(); ++t)
+			for (int i = 0; i < NUM_COUNTERS; ++i)
+			{
+				uint64_t value = threads[t]->values[i].load(std::memory_order_relaxed);
+				frame[i] += value - threads[t]->collected[i];
+				threads[t]->collected[i] = value;
+			}
+	}
+
+	s_last_frame.pixels_written = frame[WRITTEN];
+	s_last_frame.pixels_rejected = frame[REJECTED];
+	for (int p = 0; p < NUM_PRIMITIVES; ++p)
+		s_last_frame.primitives[p] = frame[PRIMITIVES + p];
+
+	s_total.pixels_written += s_last_frame.pixels_written;
+	s_total.pixels_rejected += s_last_frame.pixels_rejected;
+	for (int p = 0; p < NUM_PRIMITIVES; ++p)
+		s_total.primitives[p] += s_last_frame.primitives[p];
+}
+
+const RasterStats::Frame& RasterStats::GetLastFrame()
+{
+	return s_last_frame;
+}
+
+const RasterStats::Frame& RasterStats::GetTotal()
+{
+	return s_total;
+}
+
+std::vector<std::unique_ptr<RasterStats::Counters>>& RasterStats::GetThreads()
+{
+	static std::vector<std::unique_ptr<Counters>> threads;
+	return threads;
+}
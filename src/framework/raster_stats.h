@@ -0,0 +1,82 @@
+/*
+	+ Raster statistics: pixels written and rejected (clipped) by the drawing routines of Image and the primitives drawn.
+	+ Compile-time switch: without CG_RASTER_STATS the RASTER_COUNT_* macros compile to nothing.
+	+ Every thread counts into its own counters, EndFrame adds them up (the profiler calls it once per frame).
+*/
+
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <stdint.h>
+
+class RasterStats
+{
+public:
+	enum Primitive { POINT, LINE, RECT, TRIANGLE, IMAGE, NUM_PRIMITIVES };
+
+	struct Frame
+	{
+		uint64_t pixels_written = 0;
+		uint64_t pixels_rejected = 0;           // Outside the image
+		uint64_t primitives[NUM_PRIMITIVES] = {};
+
+		// Average writes per pixel of a width x height framebuffer (clears are not counted)
+		float GetOverdraw(unsigned int width, unsigned int height) const;
+	};
+
+	static const char* GetPrimitiveName(Primitive primitive);
+
+	// Counts since the last EndFrame, then starts a new frame
+	static void EndFrame();
+	static const Frame& GetLastFrame();
+
+	// Counts of every frame since the program started
+	static const Frame& GetTotal();
+
+	static void CountPixels(uint64_t written, uint64_t rejected)
+	{
+		Counters& counters = GetCounters();
+		Add(counters.values[WRITTEN], written);
+		Add(counters.values[REJECTED], rejected);
+	}
+	static void CountPrimitive(Primitive primitive, uint64_t count = 1)
+	{
+		Add(GetCounters().values[PRIMITIVES + primitive], count);
+	}
+
+private:
+	enum { WRITTEN, REJECTED, PRIMITIVES, NUM_COUNTERS = PRIMITIVES + NUM_PRIMITIVES };
+
+	// Written only by its thread, read by EndFrame
+	struct Counters
+	{
+		std::atomic<uint64_t> values[NUM_COUNTERS];
+		uint64_t collected[NUM_COUNTERS];       // Values at the last EndFrame
+	};
+
+	// Only the owner thread writes, so a relaxed load and store is enough (no locked add)
+	static void Add(std::atomic<uint64_t>& value, uint64_t n)
+	{
+		value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+	}
+
+	static Counters& GetCounters()
+	{
+		static thread_local Counters* counters = nullptr;
+		if (!counters)
+			counters = Register();
+		return *counters;
+	}
+	static Counters* Register();
+	static std::vector<std::unique_ptr<Counters>>& GetThreads();    // Never removed (threads can end before EndFrame)
+};
+
+#ifdef CG_RASTER_STATS
+	#define RASTER_COUNT_PIXELS(written, rejected) RasterStats::CountPixels(written, rejected)
+	#define RASTER_COUNT_PRIMITIVE(primitive, count) RasterStats::CountPrimitive(RasterStats::primitive, count)
+#else
+	#define RASTER_COUNT_PIXELS(written, rejected)
+	#define RASTER_COUNT_PRIMITIVE(primitive, count)
+#endif
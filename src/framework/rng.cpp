@@ -0,0 +1,125 @@
+#include "rng.h"
+#include <atomic>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+static std::atomic<uint64_t> thread_seed(0x853C49E6748FEA9Bull);
+static std::atomic<uint64_t> thread_streams(0);
+
+// Expands a 64 bit seed into well mixed state words
+static uint64_t SplitMix64(uint64_t& x)
+{
+	uint64_t z = (x += 0x9E3779B97F4A7C15ull);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+
+#if defined(__SSE2__) || defined(_M_X64)
+// Steps 4 lanes, returns their 24 high bits as floats in [0, 2^24)
+static inline __m128 Step4(__m128i& a, __m128i& b, __m128i& c, __m128i& d)
+{
+	__m128i r = _mm_add_epi32(a, d);
+	__m128i t = _mm_slli_epi32(b, 9);
+	c = _mm_xor_si128(c, a);
+	d = _mm_xor_si128(d, b);
+	b = _mm_xor_si128(b, c);
+	a = _mm_xor_si128(a, d);
+	c = _mm_xor_si128(c, t);
+	d = _mm_or_si128(_mm_slli_epi32(d, 11), _mm_srli_epi32(d, 21));
+	return _mm_cvtepi32_ps(_mm_srli_epi32(r, 8)); // 24 bits fit an int (faster to convert)
+}
+#endif
+
+Rng::Rng(uint64_t seed, uint64_t stream)
+{
+	Seed(seed, stream);
+}
+
+void Rng::Seed(uint64_t seed, uint64_t stream)
+{
+	uint64_t x = seed ^ SplitMix64(stream);
+	for (int l = 0; l < LANES; ++l)
+	{
+		for (int k = 0; k < 4; k += 2)
+		{
+			uint64_t v = SplitMix64(x);
+			s[k][l] = (uint32_t)v;
+			s[k + 1][l] = (uint32_t)(v >> 32);
+		}
+		// All zero is the only invalid state
+		if ((s[0][l] | s[1][l] | s[2][l] | s[3][l]) == 0)
+			s[0][l] = 1;
+	}
+	lane = 0;
+}
+
+void Rng::Fill(float* out, int n)
+{
+	FillRange(out, n, 0.0f, 1.0f);
+}
+
+void Rng::FillRange(float* out, int n, float min, float max)
+{
+	const float scale = (max - min) * (1.0f / 16777216.0f);
+
+	int i = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+	// 8 lanes in two SSE registers per state word (named, so they stay in registers for the whole loop)
+	__m128i a0 = _mm_load_si128((const __m128i*)&s[0][0]), a1 = _mm_load_si128((const __m128i*)&s[0][4]);
+	__m128i b0 = _mm_load_si128((const __m128i*)&s[1][0]), b1 = _mm_load_si128((const __m128i*)&s[1][4]);
+	__m128i c0 = _mm_load_si128((const __m128i*)&s[2][0]), c1 = _mm_load_si128((const __m128i*)&s[2][4]);
+	__m128i d0 = _mm_load_si128((const __m128i*)&s[3][0]), d1 = _mm_load_si128((const __m128i*)&s[3][4]);
+	const __m128 vmin = _mm_set1_ps(min);
+	const __m128 vscale = _mm_set1_ps(scale);
+
+	for (; i + LANES <= n; i += LANES)
+	{
+		_mm_storeu_ps(out + i, _mm_add_ps(vmin, _mm_mul_ps(Step4(a0, b0, c0, d0), vscale)));
+		_mm_storeu_ps(out + i + 4, _mm_add_ps(vmin, _mm_mul_ps(Step4(a1, b1, c1, d1), vscale)));
+	}
+
+	_mm_store_si128((__m128i*)&s[0][0], a0); _mm_store_si128((__m128i*)&s[0][4], a1);
+	_mm_store_si128((__m128i*)&s[1][0], b0); _mm_store_si128((__m128i*)&s[1][4], b1);
+	_mm_store_si128((__m128i*)&s[2][0], c0); _mm_store_si128((__m128i*)&s[2][4], c1);
+	_mm_store_si128((__m128i*)&s[3][0], d0); _mm_store_si128((__m128i*)&s[3][4], d1);
+#else
+	uint32_t* __restrict s0 = s[0];
+	uint32_t* __restrict s1 = s[1];
+	uint32_t* __restrict s2 = s[2];
+	uint32_t* __restrict s3 = s[3];
+	for (; i + LANES <= n; i += LANES)
+	{
+		float* __restrict o = out + i;
+#pragma omp simd
+		for (int l = 0; l < LANES; ++l)
+		{
+			uint32_t r = s0[l] + s3[l];
+			uint32_t t = s1[l] << 9;
+			s2[l] ^= s0[l];
+			s3[l] ^= s1[l];
+			s1[l] ^= s2[l];
+			s0[l] ^= s3[l];
+			s2[l] ^= t;
+			s3[l] = (s3[l] << 11) | (s3[l] >> 21);
+			o[l] = min + (float)(int)(r >> 8) * scale;
+		}
+	}
+#endif
+
+	for (; i < n; ++i)
+		out[i] = min + (float)(NextUInt() >> 8) * scale;
+}
+
+Rng& Rng::ForThread()
+{
+	thread_local Rng rng(thread_seed, thread_streams++);
+	return rng;
+}
+
+void Rng::SetThreadSeed(uint64_t seed)
+{
+	thread_seed = seed;
+}
@@ -0,0 +1,55 @@
+/*
+	+ Fast random number generator (xoshiro128+) meant for bulk work like spawning particles.
+	+ Not shared: use one per thread (ForThread) or one per stream of work (seed + stream id) so results are reproducible.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+class Rng
+{
+public:
+	// Independent generators stepped together by Fill (one SIMD lane each)
+	static const int LANES = 8;
+
+	// Same seed and stream always produce the same sequence, different streams are uncorrelated
+	Rng(uint64_t seed = 0x853C49E6748FEA9Bull, uint64_t stream = 0);
+	void Seed(uint64_t seed, uint64_t stream = 0);
+
+	// Next 32 random bits / float in [0,1) / float in [min,max)
+	inline uint32_t NextUInt()
+	{
+		uint32_t r = Step(lane);
+		lane = (lane + 1) & (LANES - 1);
+		return r;
+	}
+	inline float NextFloat() { return (NextUInt() >> 8) * (1.0f / 16777216.0f); }
+	inline float Range(float min, float max) { return min + NextFloat() * (max - min); }
+
+	// Fill out with n floats in [0,1) / [min,max) (vectorized)
+	void Fill(float* out, int n);
+	void FillRange(float* out, int n, float min, float max);
+
+	// Generator of the calling thread, each thread gets its own stream of the global seed
+	static Rng& ForThread();
+	static void SetThreadSeed(uint64_t seed); // Affects threads that did not use ForThread yet
+
+private:
+	// State in structure of arrays: s[k][lane]
+	alignas(32) uint32_t s[4][LANES];
+	int lane;
+
+	inline uint32_t Step(int l)
+	{
+		uint32_t r = s[0][l] + s[3][l];
+		uint32_t t = s[1][l] << 9;
+		s[2][l] ^= s[0][l];
+		s[3][l] ^= s[1][l];
+		s[1][l] ^= s[2][l];
+		s[0][l] ^= s[3][l];
+		s[2][l] ^= t;
+		s[3][l] = (s[3][l] << 11) | (s[3][l] >> 21);
+		return r;
+	}
+};
@@ -0,0 +1,339 @@
+#include "task_scheduler.h"
+#include "profiler.h"
+#include <algorithm>
+#include <string>
+
+// Worker running on this thread (index in its scheduler), -1 on other threads
+static thread_local TaskScheduler* t_scheduler = nullptr;
+static thread_local int t_worker = -1;
+
+static unsigned int s_num_threads = 0;
+
+// Shared by the threads running the ranges of a ParallelFor
+struct TaskScheduler::ParallelForState
+{
+	std::atomic<int> next_range;
+	std::atomic<int> done_ranges;
+	std::atomic<int> refs;              // Caller and helpers still using it
+	int num_ranges;
+	int begin, end, grain;
+	RangeFunction function;
+	const void* task;                   // Only valid while there are ranges left
+	ParallelForState* next_free;
+
+	// Runs ranges until there are none left
+	void Run()
+	{
+		for (int r = next_range++; r < num_ranges; r = next_range++)
+		{
+			int b = begin + r * grain;
+			function(task, b, std::min(b + grain, end));
+			done_ranges++;
+		}
+	}
+};
+
+void TaskScheduler::JobQueue::Push(const Job& job)
+{
+	if (count == jobs.size())
+	{
+		// Unroll the ring in a bigger buffer
+		std::vector<Job> bigger(std::max(jobs.size() * 2, (size_t)64));
+		for (size_t i = 0; i < count; ++i)
+			bigger[i] = jobs[(first + i) % jobs.size()];
+		jobs.swap(bigger);
+		first = 0;
+	}
+	jobs[(first + count) % jobs.size()] = job;
+	count++;
+}
+
+bool TaskScheduler::JobQueue::PopNewest(Job& job)
+{
+	if (count == 0)
+		return false;
+	count--;
+	job = jobs[(first + count) % jobs.size()];
+	return true;
+}
+
+bool TaskScheduler::JobQueue::PopOldest(Job& job)
+{
+	if (count == 0)
+		return false;
+	job = jobs[first];
+	first = (first + 1) % jobs.size();
+	count--;
+	return true;
+}
+
+TaskScheduler::TaskScheduler(unsigned int num_threads) : queued(0)
+{
+	// The main thread also does work, leave a core for it
+	if (num_threads == 0)
+	{
+		unsigned int cores = std::thread::hardware_concurrency();
+		num_threads = cores > 2 ? cores - 1 : 1;
+	}
+
+	num_workers = num_threads;
+	queues.reset(new JobQueue[num_threads + 1]);
+	for (unsigned int i = 0; i < num_threads; ++i)
+		workers.push_back(std::thread(&TaskScheduler::WorkerLoop, this, i));
+}
+
+TaskScheduler::~TaskScheduler()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		stopping = true;
+	}
+	sleep_cv.notify_all();
+
+	for (size_t i = 0; i < workers.size(); ++i)
+		workers[i].join();
+}
+
+TaskScheduler* TaskScheduler::Get()
+{
+	static TaskScheduler scheduler(s_num_threads);
+	return &scheduler;
+}
+
+void TaskScheduler::SetNumThreads(unsigned int num_threads)
+{
+	s_num_threads = num_threads;
+}
+
+void TaskScheduler::Push(const Job& job)
+{
+	// Workers push to their own queue, other threads to the shared one
+	JobQueue& queue = queues[t_scheduler == this ? t_worker : (int)num_workers];
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.Push(job);
+	}
+
+	// Taking the lock makes sure a worker going to sleep sees the new job
+	queued++;
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+	}
+	sleep_cv.notify_one();
+}
+
+// Own queue first (newest job), then the shared queue and the other workers (oldest job)
+bool TaskScheduler::FindJob(Job& job)
+{
+	const int count = (int)num_workers;
+	const int own = t_scheduler == this ? t_worker : -1;
+
+	for (int i = -1; i <= count; ++i)
+	{
+		// -1: own queue, 0: shared queue, then the workers after this one
+		int index = i < 0 ? own : (i == 0 ? count : (own + i + count) % count);
+		if (index < 0 || (i > 0 && index == own))
+			continue;
+
+		JobQueue& queue = queues[index];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (i < 0 ? queue.PopNewest(job) : queue.PopOldest(job))
+		{
+			queued--;
+			return true;
+		}
+	}
+	return false;
+}
+
+TaskScheduler::TaskHandle TaskScheduler::Add(Task task, bool main_thread, const std::vector<TaskHandle>& dependencies)
+{
+	TaskHandle handle = std::make_shared<TaskState>();
+	handle->task = std::move(task);
+	handle->main_thread = main_thread;
+
+	for (size_t i = 0; i < dependencies.size(); ++i)
+	{
+		TaskState* dependency = dependencies[i].get();
+		if (!dependency)
+			continue;
+		std::lock_guard<std::mutex> lock(dependency->mutex);
+		if (dependency->done)
+			continue;
+		dependency->dependents.push_back(handle);
+		handle->waiting++;
+	}
+
+	// Queued now if every dependency was done, otherwise by the last one to finish
+	if (--handle->waiting == 0)
+		Schedule(handle);
+	return handle;
+}
+
+void TaskScheduler::Schedule(const TaskHandle& handle)
+{
+	if (handle->main_thread)
+	{
+		std::lock_guard<std::mutex> lock(main_mutex);
+		main_tasks.push_back(handle);
+		return;
+	}
+
+	handle->self = handle;
+	Job job = { &TaskScheduler::RunTask, handle.get() };
+	Push(job);
+}
+
+void TaskScheduler::Finish(TaskState* state)
+{
+	std::vector<TaskHandle> dependents;
+	{
+		std::lock_guard<std::mutex> lock(state->mutex);
+		state->done = true;
+		dependents.swap(state->dependents);
+	}
+	state->task = nullptr;
+
+	for (size_t i = 0; i < dependents.size(); ++i)
+		if (--dependents[i]->waiting == 0)
+			Schedule(dependents[i]);
+}
+
+void TaskScheduler::RunTask(TaskScheduler* scheduler, void* data)
+{
+	TaskHandle handle = std::move(static_cast<TaskState*>(data)->self);
+	handle->task();
+	scheduler->Finish(handle.get());
+}
+
+TaskScheduler::TaskHandle TaskScheduler::Submit(Task task, const std::vector<TaskHandle>& dependencies)
+{
+	return Add(std::move(task), false, dependencies);
+}
+
+TaskScheduler::TaskHandle TaskScheduler::RunOnMainThread(Task task, const std::vector<TaskHandle>& dependencies)
+{
+	return Add(std::move(task), true, dependencies);
+}
+
+size_t TaskScheduler::PumpMainThread()
+{
+	// Take the whole queue so tasks can queue new ones without blocking
+	std::deque<TaskHandle> ready;
+	{
+		std::lock_guard<std::mutex> lock(main_mutex);
+		ready.swap(main_tasks);
+	}
+
+	for (size_t i = 0; i < ready.size(); ++i)
+	{
+		ready[i]->task();
+		Finish(ready[i].get());
+	}
+	return ready.size();
+}
+
+bool TaskScheduler::IsDone(const TaskHandle& handle)
+{
+	return !handle || handle->done;
+}
+
+void TaskScheduler::Wait(const TaskHandle& handle)
+{
+	while (!IsDone(handle))
+	{
+		Job job;
+		if (FindJob(job))
+			job.function(this, job.data);
+		else
+			std::this_thread::yield();
+	}
+}
+
+void TaskScheduler::RunRanges(TaskScheduler* scheduler, void* data)
+{
+	ParallelForState* state = static_cast<ParallelForState*>(data);
+	state->Run();
+	scheduler->ReleaseForState(state);
+}
+
+void TaskScheduler::ReleaseForState(ParallelForState* state)
+{
+	if (--state->refs > 0)
+		return;
+	std::lock_guard<std::mutex> lock(for_states_mutex);
+	state->next_free = free_for_states;
+	free_for_states = state;
+}
+
+void TaskScheduler::ParallelFor(int begin, int end, int grain, RangeFunction function, const void* task)
+{
+	if (end <= begin)
+		return;
+
+	grain = std::max(grain, 1);
+	int num_ranges = (int)(((long long)end - begin + grain - 1) / grain);
+	if (num_ranges == 1 || num_workers == 0)
+	{
+		function(task, begin, end);
+		return;
+	}
+
+	ParallelForState* state;
+	{
+		std::lock_guard<std::mutex> lock(for_states_mutex);
+		if (!free_for_states)
+		{
+			for_states.push_back(std::unique_ptr<ParallelForState>(new ParallelForState()));
+			free_for_states = for_states.back().get();
+			free_for_states->next_free = nullptr;
+		}
+		state = free_for_states;
+		free_for_states = state->next_free;
+	}
+
+	// Helpers that start late just find no ranges left
+	int helpers = std::min((int)num_workers, num_ranges - 1);
+	state->next_range = 0;
+	state->done_ranges = 0;
+	state->refs = helpers + 1;
+	state->num_ranges = num_ranges;
+	state->begin = begin;
+	state->end = end;
+	state->grain = grain;
+	state->function = function;
+	state->task = task;
+
+	Job job = { &TaskScheduler::RunRanges, state };
+	for (int i = 0; i < helpers; ++i)
+		Push(job);
+
+	state->Run();
+
+	// Wait for the ranges other threads are still running
+	while (state->done_ranges < num_ranges)
+		std::this_thread::yield();
+	ReleaseForState(state);
+}
+
+void TaskScheduler::WorkerLoop(unsigned int index)
+{
+	t_scheduler = this;
+	t_worker = (int)index;
+	Profiler::Get()->SetThreadName(("Worker " + std::to_string(index + 1)).c_str());
+
+	while (true)
+	{
+		Job job;
+		if (FindJob(job))
+		{
+			job.function(this, job.data);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(sleep_mutex);
+		sleep_cv.wait(lock, [this]() { return stopping || queued > 0; });
+		if (stopping && queued == 0)
+			return;
+	}
+}
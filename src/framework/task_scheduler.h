@@ -0,0 +1,136 @@
+/*
+	+ This class owns a pool of worker threads used to run work in the background (image decoding, encoding...).
+	+ Every worker has its own queue: tasks submitted by a worker go to its queue and it takes the newest one first,
+	  idle workers steal the oldest task of the other queues. Tasks submitted by other threads go to a shared queue.
+	+ Tasks can depend on other tasks: they are queued once every dependency is done.
+	+ Results that must be applied on the main thread are queued with RunOnMainThread and executed by the main loop.
+*/
+
+#pragma once
+
+#include <functional>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+class TaskScheduler
+{
+public:
+	typedef std::function<void()> Task;
+	typedef std::function<void(int begin, int end)> RangeTask;
+
+	// Submitted task, used to wait for it or to make other tasks depend on it
+	class TaskState;
+	typedef std::shared_ptr<TaskState> TaskHandle;
+
+	// Number of worker threads (0 = hardware concurrency - 1, at least one): with the calling thread,
+	// one thread per core works in a ParallelFor
+	TaskScheduler(unsigned int num_threads = 0);
+	~TaskScheduler();
+
+	// Shared scheduler used by the framework (created on first use)
+	static TaskScheduler* Get();
+
+	// Worker threads of the shared scheduler (0 = default), only has effect before its first use
+	static void SetNumThreads(unsigned int num_threads);
+
+	// Run a task in a worker thread once every dependency is done
+	TaskHandle Submit(Task task, const std::vector<TaskHandle>& dependencies = std::vector<TaskHandle>());
+
+	// Splits [begin, end) in ranges of 'grain' elements executed by the workers and the calling thread.
+	// Returns when every range is done. Can be called from a worker (the caller never waits for unclaimed ranges).
+	// The task is not copied: any callable with operator()(int begin, int end) const.
+	template <typename F>
+	void ParallelFor(int begin, int end, int grain, const F& task) { ParallelFor(begin, end, grain, &CallRange<F>, &task); }
+
+	// Queue a task to be executed in the main thread by PumpMainThread once every dependency is done
+	TaskHandle RunOnMainThread(Task task, const std::vector<TaskHandle>& dependencies = std::vector<TaskHandle>());
+
+	// Executes the queued main thread tasks (called once per frame by the main loop), returns how many ran
+	size_t PumpMainThread();
+
+	static bool IsDone(const TaskHandle& handle);
+
+	// Blocks until the task is done, running queued worker tasks meanwhile.
+	// Do not wait from the main thread for a task that needs PumpMainThread.
+	void Wait(const TaskHandle& handle);
+
+	unsigned int GetNumThreads() const { return num_workers; }
+
+private:
+	// Queued work: a submitted task or the helper of a ParallelFor
+	struct Job
+	{
+		void (*function)(TaskScheduler* scheduler, void* data);
+		void* data;
+	};
+
+	// Ring buffer, grows when full (the memory is kept)
+	struct JobQueue
+	{
+		std::mutex mutex;
+		std::vector<Job> jobs;
+		size_t first = 0, count = 0;
+
+		void Push(const Job& job);
+		bool PopNewest(Job& job);
+		bool PopOldest(Job& job);
+	};
+
+	struct ParallelForState;
+	typedef void (*RangeFunction)(const void* task, int begin, int end);
+
+	unsigned int num_workers;               // Set before the workers start
+	std::vector<std::thread> workers;
+	std::unique_ptr<JobQueue[]> queues;     // One per worker, the last one for the other threads
+	std::atomic<int> queued;
+	std::mutex sleep_mutex;
+	std::condition_variable sleep_cv;
+	bool stopping = false;
+
+	std::deque<TaskHandle> main_tasks;
+	std::mutex main_mutex;
+
+	// ParallelFor states are reused, helpers that start late can still read them
+	std::vector<std::unique_ptr<ParallelForState>> for_states;
+	ParallelForState* free_for_states = nullptr;
+	std::mutex for_states_mutex;
+
+	template <typename F>
+	static void CallRange(const void* task, int begin, int end) { (*static_cast<const F*>(task))(begin, end); }
+
+	void ParallelFor(int begin, int end, int grain, RangeFunction function, const void* task);
+	void ReleaseForState(ParallelForState* state);
+
+	void Push(const Job& job);
+	bool FindJob(Job& job);
+	void Schedule(const TaskHandle& handle);
+	void Finish(TaskState* state);
+	TaskHandle Add(Task task, bool main_thread, const std::vector<TaskHandle>& dependencies);
+
+	static void RunTask(TaskScheduler* scheduler, void* data);
+	static void RunRanges(TaskScheduler* scheduler, void* data);
+
+	void WorkerLoop(unsigned int index);
+};
+
+class TaskScheduler::TaskState
+{
+private:
+	friend class TaskScheduler;
+
+	Task task;
+	bool main_thread = false;
+	std::atomic<int> waiting;           // Dependencies not done yet (+1 while it is being added)
+	std::atomic<bool> done;
+	std::mutex mutex;
+	std::vector<TaskHandle> dependents; // Tasks waiting for this one
+	TaskHandle self;                    // Keeps the task alive while it is queued
+
+public:
+	TaskState() : waiting(1), done(false) {}
+};
@@ -1,5 +1,7 @@
 #include "utils.h"
+#ifndef CG_HEADLESS
 #include "GL/glew.h"
+#endif
 
 #ifdef WIN32
 	#include <windows.h>
@@ -24,11 +26,22 @@
 #endif
 
 #include "main/includes.h"
+#ifndef CG_HEADLESS
 #include "application.h"
+#endif
 #include "image.h"
+#include "task_scheduler.h"
+#include "profiler.h"
+#include "frame_arena.h"
+#include <future>
+#include <memory>
 
 std::string absResPath( const std::string& p_sFile )
 {
+	// Absolute paths (batch renderer files) are used as they are
+	if (!p_sFile.empty() && (p_sFile[0] == '/' || p_sFile[0] == '\\' || (p_sFile.size() > 1 && p_sFile[1] == ':')))
+		return p_sFile;
+
 	std::string sFullPath;
 	std::string sFileName;
 	std::string sFixedPath = std::string("../../res/") + p_sFile;
@@ -54,6 +67,7 @@ std::string absResPath( const std::string& p_sFile )
 	return sFullPath.substr( 0, sFullPath.find_last_of( "\\/" ) ) + sFileName;
 }
 
+#ifndef CG_HEADLESS
 // This function is used to access OpenGL Extensions (special features not supported by all cards)
 void* getGLProcAddress(const char* name)
 {
@@ -138,17 +152,62 @@ SDL_Window* createWindow(const char* caption, int width, int height )
 	return window;
 }
 
+// Sleeps until the performance counter reaches target. The OS sleep is not precise (1 ms or worse),
+// so it sleeps until shortly before and spins the rest.
+static void waitUntil(Uint64 target, double counter_frequency)
+{
+	const double spin_time = 0.002;
+	while (1)
+	{
+		Uint64 now = SDL_GetPerformanceCounter();
+		if (now >= target)
+			return;
+		double remaining = (target - now) / counter_frequency;
+		if (remaining > spin_time)
+			SDL_Delay((Uint32)((remaining - spin_time) * 1000.0));
+	}
+}
+
 // The application main loop
 void launchLoop(Application* app)
 {
 	SDL_Event sdlEvent;
-	Uint32 last_time = SDL_GetTicks();
 	int x,y;
 
 	SDL_GetMouseState(&x,&y);
 	app->mouse_position.set(static_cast<float>(x), static_cast<float>(y));
 
-	Uint32 start_time = SDL_GetTicks();
+	// High resolution timer (ticks of the performance counter)
+	const double counter_frequency = (double)SDL_GetPerformanceFrequency();
+	Uint64 start_counter = SDL_GetPerformanceCounter();
+	Uint64 last_counter = start_counter;
+	double accumulator = 0.0; // Time not simulated yet (seconds)
+	Uint64 next_frame = start_counter; // Frame rate cap
+
+	// Pipelined mode: Update running in a worker while the main thread renders
+	std::future<void> update_done;
+	float update_alpha = 1.0f;
+	auto wait_update = [&]() {
+		if (!update_done.valid())
+			return;
+		update_done.wait();
+		update_done = std::future<void>();
+		app->Publish();
+		app->interpolation_alpha = update_alpha;
+	};
+
+	Profiler* profiler = Profiler::Get();
+	profiler->SetThreadName("Main");
+
+	// Mouse motions of a frame (y up), sent together to OnMouseMove
+	std::vector<Vector2> motion_path;
+	auto flush_motion = [&]() {
+		if (motion_path.empty())
+			return;
+		app->mouse_position = motion_path.back();
+		app->OnMouseMove(motion_path);
+		motion_path.clear();
+	};
 
 	// Infinite loop
 	while (1)
@@ -156,30 +215,64 @@ void launchLoop(Application* app)
 		// Read keyboard state and stored in keystate
 		app->keystate = SDL_GetKeyboardState(NULL);
 
-		// Clear the window and the depth buffer
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		bool draw = !app->idle_wait || app->NeedsFrame();
+		if (draw)
+		{
+			profiler->BeginFrame();
+
+			// Clear the window and the depth buffer
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+			// Render frame
+			app->needs_redraw = false;
+			app->Render();
 
-		// Render frame
-		app->Render();
+			// Swap between front buffer and back buffer
+			PROFILE_SCOPE("SwapWindow");
+			SDL_GL_SwapWindow(app->window);
+		}
+
+		// Hand the state of the Update that ran during this frame to the next Render (events can now change the app)
+		{
+			PROFILE_SCOPE("WaitUpdate");
+			wait_update();
+		}
 
-		// Swap between front buffer and back buffer
-		SDL_GL_SwapWindow(app->window);
+		if (!draw)
+		{
+			// Nothing changes until the user does something: sleep until the next event (left in the queue).
+			// The time spent waiting is not simulated.
+			SDL_WaitEvent(NULL);
+			last_counter = SDL_GetPerformanceCounter();
+		}
 
 		// Update events
+		Vector2 frame_mouse_position = app->mouse_position;
 		while(SDL_PollEvent(&sdlEvent))
 		{
+			app->RequestRedraw();
+
+			// Mouse motions are gathered and sent together (mice can report 1000 moves per second)
+			if (sdlEvent.type == SDL_MOUSEMOTION)
+			{
+				motion_path.push_back(Vector2((float)sdlEvent.motion.x, (float)(app->window_height - sdlEvent.motion.y)));
+				continue;
+			}
+
+			// Keep the order: the moves before this event are handled first
+			flush_motion();
+
 			switch(sdlEvent.type)
 				{
-					case SDL_QUIT: return; break; // EVENT for when the user clicks the [x] in the corner
+					case SDL_QUIT: wait_update(); return; break; // EVENT for when the user clicks the [x] in the corner
 					case SDL_MOUSEBUTTONDOWN: // EXAMPLE OF sync mouse input
+						app->mouse_position.set((float)sdlEvent.button.x, (float)(app->window_height - sdlEvent.button.y));
 						app->OnMouseButtonDown(sdlEvent.button);
 						break;
 					case SDL_MOUSEBUTTONUP:
+						app->mouse_position.set((float)sdlEvent.button.x, (float)(app->window_height - sdlEvent.button.y));
 						app->OnMouseButtonUp(sdlEvent.button);
 						break;
-					case SDL_MOUSEMOTION:
-						app->OnMouseMove(sdlEvent.button);
-						break;
 					case SDL_KEYUP:  // EXAMPLE OF sync keyboard input
 						app->OnKeyPressed(sdlEvent.key);
 						break;
@@ -202,81 +295,158 @@ void launchLoop(Application* app)
 #endif
 				}
 		}
+		flush_motion();
+
+		// Deliver the results of background work (loaded images...)
+		if (TaskScheduler::Get()->PumpMainThread() > 0)
+			app->RequestRedraw();
 
 		// Get mouse position and delta
 		app->mouse_state = SDL_GetMouseState(&x,&y);
-		app->mouse_delta.set( app->mouse_position.x - x, app->window_height - app->mouse_position.y - y );
+		app->mouse_delta.set( frame_mouse_position.x - x, app->window_height - frame_mouse_position.y - y );
 		app->mouse_position.set(static_cast<float>(x), static_cast<float>(app->window_height - y));
 
 		// Update logic
-		Uint32 now = SDL_GetTicks();
-		float elapsed_time = (now - last_time) * 0.001f; // 0.001 converts from milliseconds to seconds
-		app->time = (now - start_time) * 0.001f;
-		app->Update(elapsed_time);
-		last_time = now;
+		Uint64 now = SDL_GetPerformanceCounter();
+		double elapsed_time = (now - last_counter) / counter_frequency;
+		app->time = (float)((now - start_counter) / counter_frequency);
+		last_counter = now;
+
+		int steps = 1;
+		float step_dt = (float)elapsed_time;
+		float alpha = 1.0f;
+		if (app->fixed_dt > 0.0f)
+		{
+			// Fixed timestep: simulate in steps of fixed_dt, the remainder is carried to the next frame
+			accumulator += elapsed_time;
+			steps = 0;
+			while (accumulator >= app->fixed_dt && steps < app->max_substeps)
+			{
+				accumulator -= app->fixed_dt;
+				steps++;
+			}
+
+			// Too slow to keep up, drop the time we could not simulate instead of falling further behind
+			if (accumulator >= app->fixed_dt)
+				accumulator = fmod(accumulator, (double)app->fixed_dt);
+
+			step_dt = app->fixed_dt;
+			alpha = (float)(accumulator / app->fixed_dt);
+		}
+
+		if (app->pipelined)
+		{
+			// Runs while the next frame is rendered, the results are published after its swap
+			std::shared_ptr<std::promise<void>> done = std::make_shared<std::promise<void>>();
+			update_done = done->get_future();
+			update_alpha = alpha;
+			TaskScheduler::Get()->Submit([app, steps, step_dt, done]() {
+				for (int i = 0; i < steps; ++i)
+					app->Update(step_dt);
+				done->set_value();
+			});
+		}
+		else
+		{
+			for (int i = 0; i < steps; ++i)
+				app->Update(step_dt);
+			app->interpolation_alpha = alpha;
+		}
+
+		// Frame rate cap (when late, start counting from now instead of rushing the next frames)
+		if (draw && app->max_fps > 0.0f)
+		{
+			PROFILE_SCOPE("FrameCap");
+			next_frame += (Uint64)(counter_frequency / app->max_fps);
+			Uint64 now_counter = SDL_GetPerformanceCounter();
+			if (next_frame < now_counter)
+				next_frame = now_counter;
+			else
+				waitUntil(next_frame, counter_frequency);
+		}
 
 		// Check errors in opengl only when working in debug
 		#ifdef _DEBUG
 			checkGLErrors();
 		#endif
+
+		if (draw)
+			profiler->EndFrame();
+
+		// Scratch memory of the frame
+		FrameArena::Get()->Reset();
 	}
 
 	return;
 }
+#endif
 
-std::vector<std::string> tokenize(const std::string& source, const char* delimiters, bool process_strings)
+// Calls emit(start, length) for every token of source. Tokens are whole substrings of source:
+// with process_strings a quoted string (quotes included) is a single token.
+template <typename F>
+static void splitTokens(const char* pos, const char* delimiters, bool process_strings, F emit)
 {
-	std::vector<std::string> tokens;
-
-	std::string str;
-	char del_size = (char)strlen(delimiters);
-	const char* pos = source.c_str();
+	size_t del_size = strlen(delimiters);
+	const char* start = pos;
 	char in_string = 0;
-	int i = 0;
-	while (*pos != 0)
+	for (; *pos != 0; ++pos)
 	{
 		bool split = false;
+		const char* end = pos;
 
-		if (!process_strings || (process_strings && in_string == 0))
-		{
-			for (i = 0; i < del_size && *pos != delimiters[i]; i++);
-			if (i != del_size) split = true;
-		}
+		if (!process_strings || in_string == 0)
+			split = memchr(delimiters, *pos, del_size) != NULL;
 
 		if (process_strings && (*pos == '\"' || *pos == '\''))
 		{
-			if (!str.empty() && in_string == 0) //some chars remaining
+			if (pos > start && in_string == 0) //some chars remaining
 			{
-				tokens.push_back(str);
-				str.clear();
+				emit(start, (size_t)(pos - start));
+				start = pos;
 			}
 
 			in_string = (in_string != 0 ? 0 : *pos);
 			if (in_string == 0)
 			{
-				str += *pos;
+				end = pos + 1;
 				split = true;
 			}
 		}
 
 		if (split)
 		{
-			if (!str.empty())
-			{
-				tokens.push_back(str);
-				str.clear();
-			}
+			if (end > start)
+				emit(start, (size_t)(end - start));
+			start = pos + 1;
 		}
-		else
-			str += *pos;
-		pos++;
 	}
-	if (!str.empty())
-		tokens.push_back(str);
-	return tokens;
+	if (pos > start)
+		emit(start, (size_t)(pos - start));
 }
 
+std::vector<std::string> tokenize(const std::string& source, const char* delimiters, bool process_strings)
+{
+	std::vector<std::string> tokens;
+	splitTokens(source.c_str(), delimiters, process_strings, [&tokens](const char* start, size_t length) {
+		tokens.push_back(std::string(start, length));
+	});
+	return tokens;
+}
 
+int tokenize(const char* source, const char* delimiters, const char** tokens, int max_tokens, bool process_strings)
+{
+	FrameArena* arena = FrameArena::Get();
+	int count = 0;
+	splitTokens(source, delimiters, process_strings, [&](const char* start, size_t length) {
+		if (count >= max_tokens)
+			return;
+		char* token = arena->Allocate<char>(length + 1);
+		memcpy(token, start, length);
+		token[length] = 0;
+		tokens[count++] = token;
+	});
+	return count;
+}
 
 Vector2 parseVector2(const char* text)
 {
@@ -5,18 +5,23 @@
 #pragma once
 
 #include "framework.h"
+#include "rng.h"
+#ifndef CG_HEADLESS
 #include "SDL.h"
+#endif
 #include <string>
 
 //General functions **************
 class Application;
 class Image;
 
+#ifndef CG_HEADLESS
 //check opengl errors
 bool checkGLErrors();
 
 SDL_Window* createWindow(const char* caption, int width, int height);
 void launchLoop(Application* app);
+#endif
 
 //fast random generator
 inline unsigned long frand(void) {          //period 2^96-1
@@ -29,8 +34,10 @@ inline unsigned long frand(void) {          //period 2^96-1
 }
 
 inline bool isPowerOfTwo(int n) { return (n & (n - 1)) == 0; }
-inline float randomValue() { return (frand() % 10000) / 10000.0f; }
+inline float randomValue() { return Rng::ForThread().NextFloat(); } // [0,1), thread safe
 std::string absResPath(const std::string& p_sFile);
 std::vector<std::string> tokenize(const std::string& source, const char* delimiters, bool process_strings = false);
+// Same without heap allocations: fills tokens (up to max_tokens) with copies in the frame arena, returns how many
+int tokenize(const char* source, const char* delimiters, const char** tokens, int max_tokens, bool process_strings = false);
 Vector2 parseVector2(const char* text);
 Vector3 parseVector3(const char* text, const char separator);
\ No newline at end of file
@@ -5,6 +5,8 @@
 
 #pragma once
 
+// CG_HEADLESS builds (batch rendering) only use the CPU framebuffer: no window, no OpenGL
+#ifndef CG_HEADLESS
 #include <SDL.h>
 #include <SDL_syswm.h>
 #include "GL/glew.h"
@@ -21,6 +23,7 @@
 
     #include <GL/glu.h>
 #endif
+#endif
 
 #include <iostream>
 #include <cmath>